@@ -55,3 +55,13 @@ SOFTWARE.
 #    define LEAF
 
 #endif
+
+
+// a hint for the CPU inside a spin-wait loop
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__GNUC__) && defined(__aarch64__)
+#    define CPU_RELAX() asm volatile("yield" ::: "memory")
+#else
+#    define CPU_RELAX() ((void) 0)
+#endif
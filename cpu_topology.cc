@@ -0,0 +1,159 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "cpu_topology.hh"
+#include "syscall.hh"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace bsc {
+
+
+static bool ReadCpuList(const char* path, std::vector<int>* cpus) {
+    auto file = ::fopen(path, "r");
+    if (file == nullptr)
+        return false;
+    char buf[4096];
+    bool ok = ::fgets(buf, sizeof(buf), file) != nullptr;
+    ::fclose(file);
+    if (ok)
+        *cpus = TCpuTopology::ParseCpuList(buf);
+    return ok;
+}
+
+
+int TCpuTopology::GetCpuCount() noexcept {
+    auto count = ::sysconf(_SC_NPROCESSORS_CONF);
+    return count > 0 ? count : 1;
+}
+
+
+int TCpuTopology::GetNodeCount() noexcept {
+    std::vector<int> nodes;
+    try {
+        if (!ReadCpuList("/sys/devices/system/node/possible", &nodes))
+            return 1;
+    } catch (...) {
+        return 1;
+    }
+    return nodes.empty() ? 1 : nodes.back() + 1;
+}
+
+
+std::vector<int> TCpuTopology::GetNodeCpus(int node) {
+    char path[64];
+    ::snprintf(path, sizeof(path),
+               "/sys/devices/system/node/node%d/cpulist", node);
+
+    std::vector<int> cpus;
+    if (!ReadCpuList(path, &cpus) && node == 0 && GetNodeCount() == 1) {
+        for (int cpu = 0; cpu < GetCpuCount(); ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+
+int TCpuTopology::GetCpuNode(int cpu) noexcept {
+    try {
+        auto count = GetNodeCount();
+        for (int node = 0; node < count; ++node) {
+            for (auto node_cpu: GetNodeCpus(node)) {
+                if (node_cpu == cpu)
+                    return node;
+            }
+        }
+    } catch (...) {
+    }
+    return 0;
+}
+
+
+std::vector<int> TCpuTopology::GetAllowedCpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    int res = ::sched_getaffinity(0, sizeof(set), &set);
+    ESyscallError::Validate(res, "sched_getaffinity");
+
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+
+int TCpuTopology::GetCurrentCpu() noexcept {
+    return ::sched_getcpu();
+}
+
+
+int TCpuTopology::GetCurrentNode() noexcept {
+    auto cpu = GetCurrentCpu();
+    return cpu < 0 ? 0 : GetCpuNode(cpu);
+}
+
+
+void TCpuTopology::PinCurrentThread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu: cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            throw ESyscallError("sched_setaffinity", EINVAL);
+        CPU_SET(cpu, &set);
+    }
+    int res = ::sched_setaffinity(0, sizeof(set), &set);
+    ESyscallError::Validate(res, "sched_setaffinity");
+}
+
+
+std::vector<int> TCpuTopology::ParseCpuList(const char* list) {
+    std::vector<int> cpus;
+    const char* pos = list;
+    for (;;) {
+        char* end;
+        long first = ::strtol(pos, &end, 10);
+        if (end == pos)
+            break;
+        long last = first;
+        pos = end;
+        if (*pos == '-') {
+            last = ::strtol(pos + 1, &end, 10);
+            if (end == pos + 1)
+                break;
+            pos = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+        if (*pos != ',')
+            break;
+        ++pos;
+    }
+    return cpus;
+}
+
+
+} // namespace bsc
@@ -0,0 +1,61 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include <vector>
+
+
+namespace bsc {
+
+
+// CPU and NUMA layout of the machine as reported by /sys, a machine
+// without NUMA information is a single node 0 with all CPUs.
+class TCpuTopology {
+public:
+    static int GetCpuCount() noexcept;
+
+    static int GetNodeCount() noexcept;
+
+    static std::vector<int> GetNodeCpus(int node);
+
+    // returns 0 if the node of the cpu is unknown
+    static int GetCpuNode(int cpu) noexcept;
+
+    // CPUs the current thread is allowed to run on
+    static std::vector<int> GetAllowedCpus();
+
+    // returns -1 if unknown
+    static int GetCurrentCpu() noexcept;
+
+    static int GetCurrentNode() noexcept;
+
+    // throws ESyscallError
+    static void PinCurrentThread(const std::vector<int>& cpus);
+
+    // parses the "0-3,8,10-11" format of /sys cpu lists
+    static std::vector<int> ParseCpuList(const char* list);
+};
+
+
+} // namespace bsc
@@ -29,47 +29,378 @@ namespace bsc {
 thread_local std::shared_ptr<TMailbox>
 TEdgeSlotThread::LocalMailbox = std::make_shared<TMailbox>();
 
-thread_local std::vector<TEdgeSlotTimer*> TEdgeSlotThread::ActiveTimers;
+thread_local TTimerHeap<TTimerEntry> TEdgeSlotThread::ActiveTimers;
+
+thread_local TCallbackTimerPool TEdgeSlotThread::CallbackTimers;
+
+thread_local std::unique_ptr<TTimerFd> TEdgeSlotThread::TimerFd;
+
+thread_local TTimerStats TEdgeSlotThread::TimerStats;
+
+thread_local std::shared_ptr<IClockSource> TEdgeSlotThread::ClockSource;
+
+thread_local bool TEdgeSlotThread::ClockIsMonotonic = true;
+
+thread_local ui64 TEdgeSlotThread::CachedNow = 0;
+thread_local bool TEdgeSlotThread::CachedNowStale = true;
+
+thread_local TLoopPolicy TEdgeSlotThread::LoopPolicy;
+
+thread_local TLoopStats TEdgeSlotThread::LoopStats;
+
+thread_local TRingQueue<TMessagePtr> TEdgeSlotThread::DeferredMessages;
 
 
 void TActivateTimerSignal::Consume() {
-    if (!ObjectLink->IsAlive())
+    if (!ObjectLink->IsAlive() || Redirected(this))
         return;
     Timer->Activate(std::move(ObjectLink));
 }
 
 
 void TDeactivateTimerSignal::Consume() {
-    if (!ObjectLink->IsAlive())
+    if (!ObjectLink->IsAlive() || Redirected(this))
         return;
     Timer->Deactivate(std::move(ObjectLink));
 }
 
 
-void TEdgeSlotThread::RegisterTimer(TEdgeSlotTimer* timer) {
-    UnregisterTimer(timer);
-    for (auto i = ActiveTimers.begin(); i != ActiveTimers.end(); ++i) {
-        if (timer->GetNextHitTime() >= (*i)->GetNextHitTime())
-            continue;
-        ActiveTimers.insert(i, timer);
+void TEdgeSlotThread::RegisterTimer(TTimerEntry* timer) {
+    ActiveTimers.push(timer);
+}
+
+
+void TEdgeSlotThread::UnregisterTimer(TTimerEntry* timer) {
+    ActiveTimers.erase(timer);
+}
+
+
+void TEdgeSlotThread::CleanupTimers() noexcept {
+    ActiveTimers.clear();
+    ActiveTimers.shrink_to_fit();
+    CallbackTimers.Clear();
+    TimerFd.reset();
+}
+
+
+TTimerToken TEdgeSlotThread::ScheduleAt(
+        ui64 time, TMonitorPtr link, TSlot<>* slot, ui64 slack)
+{
+    return CallbackTimers.Allocate(time, std::move(link), slot, slack);
+}
+
+
+bool TEdgeSlotThread::CancelTimer(const TTimerToken& token) noexcept {
+    auto timer = CallbackTimers.Find(token);
+    if (timer == nullptr)
+        return false;
+    ActiveTimers.erase(timer);
+    CallbackTimers.Release(timer);
+    return true;
+}
+
+
+void TCallbackTimer::Expire() {
+    auto link = std::move(Link);
+    auto slot = Slot;
+    // release before the call, the slot may schedule new timers
+    TEdgeSlotThread::CallbackTimers.Release(this);
+    TSignal<>::Deliver(std::move(link), slot);
+}
+
+
+TTimerToken TCallbackTimerPool::Allocate(
+        ui64 time, TMonitorPtr link, TSlot<>* slot, ui64 slack)
+{
+    if (FreeHead == TTimerToken::NONE) {
+        if (Constructed % CHUNK_SIZE == 0)
+            Chunks.emplace_back(new TCallbackTimer[CHUNK_SIZE]);
+        auto timer = Get(Constructed);
+        timer->Index = Constructed++;
+        timer->NextFree = FreeHead;
+        FreeHead = timer->Index;
+    }
+
+    auto timer = Get(FreeHead);
+    FreeHead = timer->NextFree;
+    ++Used;
+
+    timer->NextHit = time;
+    timer->Slack = slack;
+    timer->Link = std::move(link);
+    timer->Slot = slot;
+    TEdgeSlotThread::RegisterTimer(timer);
+
+    TTimerToken token;
+    token.Index = timer->Index;
+    token.Generation = timer->Generation;
+    return token;
+}
+
+
+TCallbackTimer* TCallbackTimerPool::Find(const TTimerToken& token) noexcept {
+    if (token.Index >= Constructed)
+        return nullptr;
+    auto timer = Get(token.Index);
+    if (timer->Generation != token.Generation || timer->Slot == nullptr)
+        return nullptr;
+    return timer;
+}
+
+
+void TCallbackTimerPool::Release(TCallbackTimer* timer) noexcept {
+    timer->Link.reset();
+    timer->Slot = nullptr;
+    ++timer->Generation;
+    timer->NextFree = FreeHead;
+    FreeHead = timer->Index;
+    --Used;
+}
+
+
+void TCallbackTimerPool::Clear() noexcept {
+    Chunks.clear();
+    Chunks.shrink_to_fit();
+    FreeHead = TTimerToken::NONE;
+    Constructed = 0;
+    Used = 0;
+}
+
+
+void TEdgeSlotThread::SetTimerBackend(TIMER_BACKEND backend) {
+    if (backend == TIMER_BACKEND::TIMERFD) {
+        if (!TimerFd)
+            TimerFd.reset(new TTimerFd);
+    } else {
+        TimerFd.reset();
+    }
+}
+
+
+bool TEdgeSlotThread::ExpireTimers(bool timer_wakeup) {
+    auto now = RefreshNow();
+    auto slice = LoopPolicy.TimerSlice;
+    ui64 hits = 0;
+    bool timers_left = false;
+
+    // the heap is ordered by deadlines, fire every timer on the top
+    // whose slack window has already opened
+    while (!ActiveTimers.empty()) {
+        auto timer = ActiveTimers.top();
+        if (now < timer->GetNextHitTime())
+            break;
+        if (slice != 0 && hits != 0) {
+            auto current = GetNow();
+            if (current >= now && current - now >= slice) {
+                ++LoopStats.SlicesExhausted;
+                auto backlog = current - timer->GetNextHitTime();
+                if (LoopStats.MaxTimerBacklog < backlog)
+                    LoopStats.MaxTimerBacklog = backlog;
+                timers_left = true;
+                break;
+            }
+        }
+        ActiveTimers.pop();
+        RecordTimerHit(now - timer->GetNextHitTime());
+        timer->Expire();
+        ++hits;
+    }
+
+    if (hits != 0) {
+        if (timer_wakeup) {
+            ++TimerStats.Wakeups;
+            --hits;
+        }
+        TimerStats.WakeupsSaved += hits;
+        RefreshNow();
+    }
+    return timers_left;
+}
+
+
+thread_local std::vector<std::unique_ptr<TBlockLatch>> TBlockBatch::Latches;
+
+thread_local size_t TBlockBatch::LatchesInUse = 0;
+
+thread_local ui32 TBlockBatch::PumpLevel = 0;
+
+
+TBlockLatch* TBlockBatch::Add() {
+    if (Latch == nullptr) {
+        // a slot called while waiting may have a batch too
+        if (LatchesInUse == Latches.size())
+            Latches.emplace_back(new TBlockLatch);
+        Latch = Latches[LatchesInUse++].get();
+        Latch->Reset();
+        // set before any signal is queued, signals read it without a lock
+        Pumping = CanPump();
+        if (Pumping)
+            Latch->Notify = TEdgeSlotThread::LocalMailbox;
+    }
+    Latch->Add();
+    return Latch;
+}
+
+
+void TBlockBatch::Wait() noexcept {
+    if (Latch == nullptr)
+        return;
+    if (Pumping)
+        Pump();
+    else
+        Latch->Wait();
+    Latch = nullptr;
+    --LatchesInUse;
+}
+
+
+bool TBlockBatch::CanPump() noexcept {
+    const auto& mailbox = TEdgeSlotThread::LocalMailbox;
+    return PumpLevel < TEdgeSlotThread::GetLoopPolicy().PumpDepth &&
+        mailbox && !mailbox->IsStrand();
+}
+
+
+void TBlockBatch::Pump() noexcept {
+    if (!Latch->Arrive()) {
+        ++TEdgeSlotThread::LoopStats.PumpedWaits;
+        ++PumpLevel;
+        auto latch = Latch;
+        bool quit = TEdgeSlotThread::MessageLoop(
+            [latch]() { return !latch->Done(); });
+        --PumpLevel;
+        // the last signal has posted the latch, or will post it if the
+        // loop has been quit
+        Latch->WaitArrived();
+        if (quit)
+            TEdgeSlotThread::PostSelfQuitMessage();
+    }
+    Latch->Notify.reset();
+}
+
+
+void TEdgeSlotThread::RunDeferred(TMailbox* mailbox) noexcept {
+    TMessagePtr msg;
+    for (auto quota = DeferredMessages.size(); quota != 0; --quota) {
+        DeferredMessages.pop(&msg);
+        try {
+            msg->Consume();
+        } catch (...) {
+        }
+        msg.reset();
+    }
+    while (DeferredMessages.pop(&msg))
+        mailbox->enqueue(std::move(msg));
+}
+
+
+TMessagePtr TEdgeSlotThread::PollMailbox() {
+    // the clock is read once in a while, not on every spin
+    constexpr ui32 CLOCK_SPINS = 64;
+    auto yield_period = LoopPolicy.BusyPollYield;
+    auto yield_at = yield_period != 0 ? RefreshNow() + yield_period : ~(ui64) 0;
+
+    for (ui32 spins = 1;; ++spins) {
+        auto msg = LocalMailbox->try_dequeue();
+        if (msg.get() != nullptr)
+            return msg;
+        if (!LocalMailbox->IsBusyPolling()) {
+            // pairs with the fence in TMailbox::enqueue, a message of
+            // a producer that skipped the wakeup is visible after it
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return msg;
+        }
+        if (spins % CLOCK_SPINS == 0) {
+            auto now = RefreshNow();
+            if (!ActiveTimers.empty() && ActiveTimers.top()->GetNextHitTime() <= now)
+                return msg;
+            if (now >= yield_at) {
+                ++LoopStats.BusyPollYields;
+                std::this_thread::yield();
+                yield_at = RefreshNow() + yield_period;
+            }
+        }
+        CPU_RELAX();
+    }
+}
+
+
+static MAILBOX_WAKEUP GetMailboxWakeup(const TEdgeSlotThread::TOptions& options) {
+    return options.TimerBackend == TIMER_BACKEND::TIMERFD
+        ? MAILBOX_WAKEUP::EVENTFD
+        : MAILBOX_WAKEUP::SEMAPHORE;
+}
+
+
+TEdgeSlotThread::TEdgeSlotThread(const TOptions& options) {
+    if (options.Cpus.empty() && options.NumaNode < 0) {
+        Mailbox = std::make_shared<TMailbox>(GetMailboxWakeup(options));
+        if (options.BusyPoll)
+            Mailbox->SetBusyPoll(true);
+        Thread = std::thread(ThreadMessageLoop, Mailbox, options);
         return;
     }
-    ActiveTimers.push_back(timer);
+
+    std::promise<std::shared_ptr<TMailbox>> placed;
+    auto mailbox = placed.get_future();
+    Thread = std::thread(PinnedMessageLoop, std::move(placed), options);
+    try {
+        Mailbox = mailbox.get();
+    } catch (...) {
+        Thread.join();
+        throw;
+    }
+    if (options.BusyPoll)
+        Mailbox->SetBusyPoll(true);
+
+    if (options.Cpus.empty()) {
+        NumaNode = options.NumaNode;
+        return;
+    }
+    NumaNode = TCpuTopology::GetCpuNode(options.Cpus.front());
+    for (auto cpu: options.Cpus) {
+        if (TCpuTopology::GetCpuNode(cpu) != NumaNode) {
+            NumaNode = -1;
+            break;
+        }
+    }
 }
 
 
-void TEdgeSlotThread::UnregisterTimer(TEdgeSlotTimer* timer) {
-    for (auto i = ActiveTimers.begin(); i != ActiveTimers.end(); ++i) {
-        if (timer != *i)
-            continue;
-        ActiveTimers.erase(i);
-        break;
+void TEdgeSlotThread::PinnedMessageLoop(
+        std::promise<std::shared_ptr<TMailbox>> placed,
+        TOptions options) noexcept
+{
+    std::shared_ptr<TMailbox> mailbox;
+    try {
+        auto cpus = options.Cpus;
+        if (cpus.empty())
+            cpus = TCpuTopology::GetNodeCpus(options.NumaNode);
+        if (cpus.empty())
+            throw ESyscallError("sched_setaffinity", EINVAL);
+        TCpuTopology::PinCurrentThread(cpus);
+        // first touch from the pinned thread
+        mailbox = std::make_shared<TMailbox>(GetMailboxWakeup(options));
+    } catch (...) {
+        placed.set_exception(std::current_exception());
+        return;
     }
+    placed.set_value(mailbox);
+    ThreadMessageLoop(std::move(mailbox), std::move(options));
 }
 
 
-void TEdgeSlotThread::ThreadMessageLoop(TEdgeSlotThread* self) noexcept {
-    LocalMailbox = self->Mailbox;
+void TEdgeSlotThread::ThreadMessageLoop(
+        std::shared_ptr<TMailbox> mailbox, TOptions options) noexcept
+{
+    LocalMailbox = std::move(mailbox);
+    SetClockSource(std::move(options.Clock));
+    SetLoopPolicy(options.LoopPolicy);
+    try {
+        SetTimerBackend(options.TimerBackend);
+    } catch (ESyscallError&) {
+        // no timerfd, fall back to timed waits of the mailbox
+    }
     MessageLoop();
 }
 
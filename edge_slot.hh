@@ -31,9 +31,20 @@ SOFTWARE.
 #include <tuple>
 #include <memory>
 #include <thread>
+#include <future>
+#include <functional>
 #include "spinrwlock.hh"
 #include "mt_semaphore.hh"
+#include "mt_latch.hh"
+#include "timer_heap.hh"
+#include "ring_queue.hh"
+#include "mt_eventfd.hh"
+#include "mt_timerfd.hh"
+#include "loop_clock.hh"
+#include "cpu_topology.hh"
 #include <time.h>
+#include <poll.h>
+#include <type_traits>
 
 
 namespace bsc {
@@ -45,9 +56,16 @@ class TEdge;
 template <typename...TParams>
 class TSlot;
 
+template <typename...TParams>
+class TLimitedSignal;
+
 template <typename...TParams>
 using TConnectCallee = void (*)(const TSlot<TParams...>*, void*, TParams...);
 
+// runs in the emitting thread, a signal it rejects is not delivered
+template <typename...TParams>
+using TSignalFilter = std::function<bool(const TParams&...)>;
+
 
 class IMessage {
 public:
@@ -59,56 +77,337 @@ public:
 using TMessagePtr = std::shared_ptr<IMessage>;
 
 
+enum class MAILBOX_WAKEUP {
+    SEMAPHORE,
+    EVENTFD, // allows to wait for a timerfd together with the mailbox
+};
+
+
 class TMailbox {
 public:
+    explicit TMailbox(MAILBOX_WAKEUP wakeup = MAILBOX_WAKEUP::SEMAPHORE) {
+        if (wakeup == MAILBOX_WAKEUP::EVENTFD)
+            Event.reset(new TEventFd);
+    }
+
+    virtual ~TMailbox() = default;
+
     void enqueue(TMessagePtr msg) {
+        Enqueued.fetch_add(1, std::memory_order_relaxed);
         Queue.enqueue(std::move(msg));
+        if (Strand) {
+            Notify();
+            return;
+        }
+        if (BusyPoll.load(std::memory_order_relaxed)) {
+            // pairs with the fence in TEdgeSlotThread::PollMailbox
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (BusyPoll.load(std::memory_order_relaxed))
+                return;
+        }
+        if (Event) {
+            // pairs with the fence in WaitEvent
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (Sleeping.load(std::memory_order_relaxed) &&
+                    Sleeping.exchange(false, std::memory_order_seq_cst))
+                Event->Post();
+            return;
+        }
         if (Sem.Get() <= 0)
             Sem.Post();
     }
 
+    // returns nullptr if busy polling has been switched on while waiting
     TMessagePtr dequeue() {
         TMessagePtr result;
         for (;;) {
-            if (Queue.dequeue(&result))
+            if (Pop(&result))
+                return result;
+            if (IsBusyPolling())
                 return result;
-            Sem.Wait();
+            if (Event)
+                WaitEvent(nullptr, nullptr);
+            else
+                Sem.Wait();
         }
     }
 
     TMessagePtr dequeue(ui64 wait_time) {
         TMessagePtr result;
         for (;;) {
-            if (Queue.dequeue(&result))
+            if (Pop(&result) || IsBusyPolling())
                 return result;
-            if (Sem.Wait(wait_time))
+            if (Event) {
+                timespec ts;
+                ts.tv_sec = wait_time / 1000000;
+                ts.tv_nsec = (wait_time % 1000000) * 1000;
+                if (WaitEvent(nullptr, &ts))
+                    return TMessagePtr();
+            } else if (Sem.Wait(wait_time)) {
                 return TMessagePtr();
+            }
         }
     }
 
+    // returns nullptr if the timer expired, requires MAILBOX_WAKEUP::EVENTFD
+    TMessagePtr dequeue(TTimerFd* timer) {
+        TMessagePtr result;
+        for (;;) {
+            if (Pop(&result) || IsBusyPolling())
+                return result;
+            if (WaitEvent(timer, nullptr))
+                return TMessagePtr();
+        }
+    }
+
+    // does not wait, returns nullptr if the mailbox is empty
+    TMessagePtr try_dequeue() {
+        TMessagePtr result;
+        Pop(&result);
+        return result;
+    }
+
+    // consumer side only
+    bool empty() const noexcept {
+        return Queue.empty();
+    }
+
+    bool IsStrand() const noexcept {
+        return Strand;
+    }
+
+    bool IsPollable() const noexcept {
+        return Event.get() != nullptr;
+    }
+
+    // The consumer of a busy-polled mailbox spins instead of waiting, and
+    // producers skip the wakeup. May be switched by any thread at any time.
+    void SetBusyPoll(bool enable) noexcept {
+        BusyPoll.store(enable, std::memory_order_relaxed);
+        // a producer that still sees the old value has already queued its
+        // message by now and the consumer will find it before it waits
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // the consumer may be waiting and has to start spinning
+        if (enable)
+            Wakeup();
+    }
+
+    bool IsBusyPolling() const noexcept {
+        return BusyPoll.load(std::memory_order_relaxed);
+    }
+
+    // messages consumed so far, may be read by any thread
+    ui64 GetDequeued() const noexcept {
+        return Dequeued.load(std::memory_order_relaxed);
+    }
+
+    // approximate number of queued messages, may be read by any thread
+    ui64 GetDepth() const noexcept {
+        auto dequeued = Dequeued.load(std::memory_order_relaxed);
+        auto enqueued = Enqueued.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
 protected:
     MPSC_TailSwap<TMessagePtr> Queue;
     TSemaphore Sem;
+    std::unique_ptr<TEventFd> Event;
+    std::atomic<bool> Sleeping = {false};
+    std::atomic<bool> BusyPoll = {false};
+    std::atomic<ui64> Enqueued = {0};
+    std::atomic<ui64> Dequeued = {0}; // written by the consumer only
+    const bool Strand = false;
+
+    void Wakeup() {
+        if (Event)
+            Event->Post();
+        else if (Sem.Get() <= 0)
+            Sem.Post();
+    }
+
+    bool Pop(TMessagePtr* msg) {
+        if (!Queue.dequeue(msg))
+            return false;
+        Dequeued.store(
+            Dequeued.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+        return true;
+    }
+
+    // a strand is not drained by a thread of its own, see TEdgeSlotPool
+    struct TStrandTag {};
+
+    explicit TMailbox(TStrandTag)
+        : Strand(true)
+    {}
+
+    // called instead of a wakeup after a message is enqueued to a strand
+    virtual void Notify() {}
+
+    // returns true if the timer or the timeout has expired
+    bool WaitEvent(TTimerFd* timer, const timespec* timeout) {
+        Sleeping.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!Queue.empty()) {
+            Sleeping.store(false, std::memory_order_relaxed);
+            return false;
+        }
+
+        pollfd fds[2] = {
+            {Event->GetFd(), POLLIN, 0},
+            {timer != nullptr ? timer->GetFd() : -1, POLLIN, 0},
+        };
+        int res = ::ppoll(fds, timer != nullptr ? 2 : 1, timeout, nullptr);
+        Sleeping.store(false, std::memory_order_relaxed);
+        if (res == -1) {
+            if (errno == EINTR)
+                return false;
+            throw ESyscallError("ppoll");
+        }
+
+        if (fds[0].revents != 0)
+            Event->Drain();
+        if (res == 0)
+            return true;
+        if (timer != nullptr && fds[1].revents != 0) {
+            timer->Drain();
+            return true;
+        }
+        return false;
+    }
+};
+
+
+enum class TIMER_BACKEND {
+    MAILBOX_WAIT, // timed wait of the mailbox semaphore
+    TIMERFD, // absolute CLOCK_MONOTONIC deadline armed in a timerfd
+};
+
+
+struct TTimerStats {
+    ui64 Hits = 0;
+    ui64 TotalLateness = 0; // in microseconds
+    ui64 MaxLateness = 0; // in microseconds
+    ui64 Wakeups = 0; // wakeups of the loop that were caused by timers
+    ui64 WakeupsSaved = 0; // hits that did not need a wakeup of their own
+    ui64 SkippedPeriods = 0; // see TIMER_DRIFT::SKIP
+};
+
+
+// How the message loop of a thread shares its time between messages and
+// expired timers. The defaults interleave one message with all expired
+// timers.
+struct TLoopPolicy {
+    // messages consumed before timers are checked again, 0 is unlimited
+    ui32 MessageBudget = 1;
+    // microseconds spent on expired timers before messages are checked
+    // again, 0 is unlimited
+    ui64 TimerSlice = 0;
+    // microseconds a busy-polling loop spins before it yields the CPU
+    // once, 0 never yields
+    ui64 BusyPollYield = 0;
+    // how many message loops may be nested in a thread that waits for its
+    // BLOCK_QUEUE signals, 0 waits without running the loop
+    ui32 PumpDepth = 0;
+};
+
+
+struct TLoopStats {
+    ui64 Iterations = 0;
+    ui64 Messages = 0;
+    ui64 BudgetsExhausted = 0; // message budget ran out, messages left
+    ui64 SlicesExhausted = 0; // timer slice ran out, expired timers left
+    ui64 MaxTimerBacklog = 0; // the most overdue timer left by a slice, us
+    ui64 BusyPollYields = 0; // see TLoopPolicy::BusyPollYield
+    ui64 PumpedWaits = 0; // BLOCK_QUEUE waits that ran the message loop
+    ui64 ExpiredSignals = 0; // dropped unconsumed, see TConnectOptions::Ttl
+};
+
+
+enum class TIMER_DRIFT {
+    CATCH_UP, // fire every missed period of a repeating timer
+    SKIP, // fire once and continue with the next period in the future
+};
+
+
+// An item of the timer heap of a thread.
+class TTimerEntry: public TTimerHeapHook {
+public:
+    virtual ~TTimerEntry() noexcept = default;
+
+    // called by the message loop when the entry has been taken off the heap
+    virtual void Expire() = 0;
+
+    ui64 GetNextHitTime() const noexcept {
+        return NextHit;
+    }
+
+    // the latest time the timer may fire at
+    ui64 GetDeadline() const noexcept {
+        return NextHit + Slack;
+    }
+
+protected:
+    ui64 NextHit = 0;
+    ui64 Slack = 0;
+};
+
+
+class TTimerToken {
+public:
+    static constexpr ui32 NONE = ~(ui32) 0;
+
+    bool empty() const noexcept {
+        return Index == NONE;
+    }
+
+    void reset() noexcept {
+        Index = NONE;
+    }
+
+protected:
+    ui32 Index = NONE;
+    ui32 Generation = 0;
+
+    friend class TCallbackTimerPool;
 };
 
 
 class TObjectAnchor;
 class TEdgeSlotObject;
 class TEdgeSlotTimer;
+class TCallbackTimerPool;
+class TMonitorPtr;
 
 
 class TEdgeSlotThread {
 public:
+    struct TOptions {
+        TIMER_BACKEND TimerBackend = TIMER_BACKEND::MAILBOX_WAIT;
+        std::shared_ptr<IClockSource> Clock; // CLOCK_MONOTONIC if empty
+        TLoopPolicy LoopPolicy;
+        // The thread is pinned to Cpus, or to the CPUs of NumaNode if Cpus
+        // is empty. A pinned thread allocates its own mailbox, so the
+        // mailbox is local to the node of the thread.
+        std::vector<int> Cpus;
+        int NumaNode = -1;
+        // start with a busy-polled mailbox, see TMailbox::SetBusyPoll()
+        bool BusyPoll = false;
+    };
+
     TEdgeSlotThread()
-        : Mailbox(std::make_shared<TMailbox>())
-    {
-        Thread = std::thread(ThreadMessageLoop, this);
-    }
+        : TEdgeSlotThread(TOptions())
+    {}
+
+    // throws ESyscallError if the thread can not be pinned
+    explicit TEdgeSlotThread(const TOptions& options);
 
     TEdgeSlotThread(TEdgeSlotThread&&) = default;
     TEdgeSlotThread& operator=(TEdgeSlotThread&&) = default;
 
-    template <class Fn, class...Params>
+    template <class Fn, class...Params,
+              typename = std::enable_if_t<
+                  !std::is_same<std::decay_t<Fn>, TOptions>::value>>
     explicit TEdgeSlotThread(Fn&& fn, Params&&...params)
         : Mailbox(std::make_shared<TMailbox>())
     {
@@ -127,6 +426,12 @@ public:
         return Mailbox;
     }
 
+    // the node the thread is pinned to, -1 if the thread is not pinned
+    // or its CPUs span several nodes
+    int GetNumaNode() const noexcept {
+        return NumaNode;
+    }
+
     static thread_local std::shared_ptr<TMailbox> LocalMailbox;
 
     void join() {
@@ -164,20 +469,113 @@ public:
     	LocalMailbox->enqueue(std::move(msg));
     }
 
+    // runs until condition() returns false, returns true if the loop has
+    // been quit by a quit message instead
     template <typename Fn>
-    static void MessageLoop(Fn&& condition) noexcept;
+    static bool MessageLoop(Fn&& condition) noexcept;
 
     static void MessageLoop() noexcept {
         auto always_true = []() -> bool { return true; };
         MessageLoop(always_true);
     }
 
-    static void RegisterTimer(TEdgeSlotTimer* timer);
-    static void UnregisterTimer(TEdgeSlotTimer* timer);
+    // Queues the message to the current thread without the mailbox. The
+    // message loop consumes deferred messages before the mailbox ones, but
+    // messages deferred by them wait for the mailbox to have a turn, so a
+    // slot that keeps deferring to itself does not starve the mailbox.
+    static void Defer(TMessagePtr msg) {
+        DeferredMessages.push(std::move(msg));
+    }
+
+    // Consumes the deferred messages queued so far, the messages they defer
+    // go to the mailbox. The message loop does it by itself.
+    static void RunDeferred(TMailbox* mailbox) noexcept;
+
+    static void RegisterTimer(TTimerEntry* timer);
+    static void UnregisterTimer(TTimerEntry* timer);
+
+    static void CleanupTimers() noexcept;
+
+    // Calls the slot once after delay microseconds. The timer lives in the
+    // current thread, the slot is called in the thread of its object if
+    // the object is still alive. No TEdgeSlotObject is needed for the timer.
+    template <typename TObject>
+    static TTimerToken ScheduleAfter(
+            ui64 delay, const TObject* object, TSlot<>* slot, ui64 slack = 0);
+
+    static TTimerToken ScheduleAt(
+            ui64 time, TMonitorPtr link, TSlot<>* slot, ui64 slack = 0);
+
+    // returns false if the timer has already fired or has been cancelled,
+    // call it in the thread that scheduled the timer
+    static bool CancelTimer(const TTimerToken& token) noexcept;
+
+    // selects how the message loop of the current thread waits for timers,
+    // TIMERFD requires the local mailbox to be MAILBOX_WAKEUP::EVENTFD
+    static void SetTimerBackend(TIMER_BACKEND backend);
+
+    static const TTimerStats& GetTimerStats() noexcept {
+        return TimerStats;
+    }
+
+    static void ResetTimerStats() noexcept {
+        TimerStats = TTimerStats();
+    }
+
+    // clock of the current thread, CLOCK_MONOTONIC if clock is empty
+    static void SetClockSource(std::shared_ptr<IClockSource> clock) noexcept {
+        ClockIsMonotonic = !clock || clock->IsMonotonic();
+        ClockSource = std::move(clock);
+    }
+
+    static ui64 GetNow() {
+        if (ClockSource)
+            return ClockSource->GetNow();
+        return TMonotonicClock::Now();
+    }
+
+    // time of the current message loop iteration, does not query the clock
+    static ui64 GetCachedNow() noexcept {
+        return CachedNow;
+    }
+
+    static ui64 RefreshNow() {
+        CachedNowStale = false;
+        return CachedNow = GetNow();
+    }
+
+    // like GetCachedNow(), but reads the clock if it has not been read in
+    // the current loop iteration yet
+    static ui64 GetLoopNow() {
+        return CachedNowStale ? RefreshNow() : CachedNow;
+    }
+
+    // CLOCK_MONOTONIC time, GetLoopNow() if the clock of the thread is
+    // comparable with it. Deadlines passed between threads use this time.
+    static ui64 GetMonotonicLoopNow() {
+        return ClockIsMonotonic ? GetLoopNow() : TMonotonicClock::Now();
+    }
+
+    // for code that consumes messages without MessageLoop(), the next
+    // GetLoopNow() reads the clock
+    static void InvalidateNow() noexcept {
+        CachedNowStale = true;
+    }
+
+    static void SetLoopPolicy(const TLoopPolicy& policy) noexcept {
+        LoopPolicy = policy;
+    }
+
+    static const TLoopPolicy& GetLoopPolicy() noexcept {
+        return LoopPolicy;
+    }
+
+    static const TLoopStats& GetLoopStats() noexcept {
+        return LoopStats;
+    }
 
-    static void CleanupTimers() noexcept {
-    	ActiveTimers.clear();
-    	ActiveTimers.shrink_to_fit();
+    static void ResetLoopStats() noexcept {
+        LoopStats = TLoopStats();
     }
 
 
@@ -194,9 +592,68 @@ public:
 protected:
     std::shared_ptr<TMailbox> Mailbox;
     std::thread Thread;
-    static thread_local std::vector<TEdgeSlotTimer*> ActiveTimers;
+    int NumaNode = -1;
+    static thread_local TTimerHeap<TTimerEntry> ActiveTimers;
+    static thread_local TCallbackTimerPool CallbackTimers;
+    static thread_local std::unique_ptr<TTimerFd> TimerFd;
+    static thread_local TTimerStats TimerStats;
+    static thread_local std::shared_ptr<IClockSource> ClockSource;
+    static thread_local bool ClockIsMonotonic;
+    static thread_local ui64 CachedNow;
+    static thread_local bool CachedNowStale;
+    static thread_local TLoopPolicy LoopPolicy;
+    static thread_local TLoopStats LoopStats;
+    static thread_local TRingQueue<TMessagePtr> DeferredMessages;
+
+    static constexpr size_t NEW_DEFERRED_RUN = ~(size_t) 0;
+
+    // Deferred messages go first, but a run of them takes only those that
+    // were queued when the run started, then the mailbox gets a turn.
+    // *quota is what is left of the run.
+    static TMessagePtr TryDequeue(size_t* quota) {
+        if (*quota == NEW_DEFERRED_RUN)
+            *quota = DeferredMessages.size();
+        TMessagePtr msg;
+        if (*quota != 0 && DeferredMessages.pop(&msg)) {
+            --*quota;
+            return msg;
+        }
+        *quota = NEW_DEFERRED_RUN;
+        return LocalMailbox->try_dequeue();
+    }
+
+    // fires expired timers, returns true if the timer slice has run out
+    // and some expired timers are left
+    static bool ExpireTimers(bool timer_wakeup);
+
+    // spins on the local mailbox, returns nullptr if the first timer is
+    // due or busy polling has been switched off
+    static TMessagePtr PollMailbox();
+
+    static void ThreadMessageLoop(
+            std::shared_ptr<TMailbox> mailbox, TOptions options) noexcept;
+
+    static void PinnedMessageLoop(
+            std::promise<std::shared_ptr<TMailbox>> placed,
+            TOptions options) noexcept;
+
+    friend class TEdgeSlotTimer;
+    friend class TCallbackTimer;
+    friend class TBlockBatch;
 
-    static void ThreadMessageLoop(TEdgeSlotThread* self) noexcept;
+    template <typename...>
+    friend class TLimitedSignal;
+
+    static void RecordSkippedPeriods(ui64 missed) noexcept {
+        TimerStats.SkippedPeriods += missed;
+    }
+
+    static void RecordTimerHit(ui64 lateness) noexcept {
+        ++TimerStats.Hits;
+        TimerStats.TotalLateness += lateness;
+        if (TimerStats.MaxLateness < lateness)
+            TimerStats.MaxLateness = lateness;
+    }
 
     template <class Fn, class...Params>
     static void
@@ -207,11 +664,53 @@ protected:
 };
 
 
+// Senders of signals to an object, sampled for TEdgeSlotBalancer. The
+// sender seen most often is tracked by a majority vote: a signal from the
+// candidate raises its lead, a signal from another thread lowers it, and
+// a candidate without a lead is replaced. Races between senders only make
+// the vote less precise.
+class TAffinitySample {
+public:
+    void Record(const TMailbox* sender) noexcept {
+        Signals.fetch_add(1, std::memory_order_relaxed);
+        if (Candidate.load(std::memory_order_relaxed) == sender) {
+            Lead.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (Lead.fetch_sub(1, std::memory_order_relaxed) <= 0) {
+            Candidate.store(sender, std::memory_order_relaxed);
+            Lead.store(1, std::memory_order_relaxed);
+        }
+    }
+
+    struct TSnapshot {
+        ui64 Signals;
+        i64 Lead;
+        const TMailbox* Candidate;
+    };
+
+    // returns the counters since the previous call
+    TSnapshot Take() noexcept {
+        TSnapshot result;
+        result.Signals = Signals.exchange(0, std::memory_order_relaxed);
+        result.Lead = Lead.exchange(0, std::memory_order_relaxed);
+        result.Candidate = Candidate.load(std::memory_order_relaxed);
+        return result;
+    }
+
+protected:
+    std::atomic<ui64> Signals = {0};
+    std::atomic<i64> Lead = {0};
+    std::atomic<const TMailbox*> Candidate = {nullptr};
+};
+
+
 class TObjectMonitor {
 public:
     TObjectMonitor()
         : RefCounter(1)
         , Mailbox(TEdgeSlotThread::LocalMailbox)
+        , RawMailbox(Mailbox.get())
     {}
 
     TObjectMonitor(const TObjectMonitor&) = delete;
@@ -232,8 +731,9 @@ public:
         // RefCounter -= 1  and AddReference() in one operation
         RefCounter.fetch_add(1, std::memory_order_seq_cst);
 
-        // Drop mailbox to avoid cyclic referencing
+        // Drop mailbox and held messages to avoid cyclic referencing
         SetMailbox(std::shared_ptr<TMailbox>());
+        TakeHeld();
         RemoveReference();
     }
 
@@ -247,22 +747,89 @@ public:
     }
 
     void SetMailbox(std::shared_ptr<TMailbox> mailbox) noexcept {
+        std::shared_ptr<TMailbox> prev;
         TWriteGuard guard(&MailboxLock);
+        prev.swap(Mailbox);
         Mailbox = std::move(mailbox);
+        RawMailbox.store(Mailbox.get(), std::memory_order_release);
+        Epoch.fetch_add(1, std::memory_order_release);
     }
 
     bool SameMailbox() const noexcept {
-        TReadGuard guard(&MailboxLock); // UB if no read guard
-        return TEdgeSlotThread::LocalMailbox == Mailbox;
+        // the monitor keeps its mailbox alive, comparing pointers is safe
+        return TEdgeSlotThread::LocalMailbox.get() ==
+            RawMailbox.load(std::memory_order_acquire);
+    }
+
+    // Enqueues to the mailbox of the object, the object can not move
+    // meanwhile. epoch receives the epoch of the mailbox.
+    bool Enqueue(TMessagePtr msg, ui32* epoch) {
+        TReadGuard guard(&MailboxLock);
+        if (Mailbox.get() == nullptr)
+            return false;
+        *epoch = Epoch.load(std::memory_order_relaxed);
+        Mailbox->enqueue(std::move(msg));
+        return true;
+    }
+
+    // set while messages for the object from its previous mailbox are
+    // on the way, see TMigrateMsg
+    bool IsFenced() const noexcept {
+        return Fenced.load(std::memory_order_acquire);
+    }
+
+    void SetFenced(bool fenced) noexcept {
+        Fenced.store(fenced, std::memory_order_release);
+    }
+
+    // the held messages are touched by the thread of the object only
+    void Hold(TMessagePtr msg) {
+        if (!Held)
+            Held.reset(new std::vector<TMessagePtr>);
+        Held->push_back(std::move(msg));
+    }
+
+    std::vector<TMessagePtr> TakeHeld() noexcept {
+        std::vector<TMessagePtr> result;
+        if (Held)
+            result.swap(*Held);
+        Held.reset();
+        return result;
+    }
+
+    // changes every time the object is moved to another mailbox
+    ui32 GetEpoch() const noexcept {
+        return Epoch.load(std::memory_order_acquire);
+    }
+
+    TAffinitySample* GetAffinitySample() const noexcept {
+        return Sample.load(std::memory_order_relaxed);
+    }
+
+    TAffinitySample* EnableAffinitySample() {
+        auto sample = GetAffinitySample();
+        if (sample != nullptr)
+            return sample;
+        std::unique_ptr<TAffinitySample> created(new TAffinitySample);
+        if (Sample.compare_exchange_strong(sample, created.get()))
+            return created.release();
+        return sample;
     }
 
 protected:
-    ~TObjectMonitor() noexcept = default;
+    ~TObjectMonitor() noexcept {
+        delete Sample.load(std::memory_order_relaxed);
+    }
 
     friend class TObjectAnchor;
 
     std::atomic<uintptr_t> RefCounter;
     std::shared_ptr<TMailbox> Mailbox;
+    std::atomic<const TMailbox*> RawMailbox;
+    std::atomic<ui32> Epoch = {0};
+    std::atomic<TAffinitySample*> Sample = {nullptr};
+    std::atomic<bool> Fenced = {false};
+    std::unique_ptr<std::vector<TMessagePtr>> Held;
     mutable TSpinRWLock MailboxLock;
 };
 
@@ -403,6 +970,15 @@ public:
         MoveToMailbox(thread->GetMailbox());
     }
 
+    // Moves the object from the thread it belongs to, so the move never
+    // happens while the object is busy. Signals on the way follow the
+    // object to the new thread.
+    void MigrateToMailbox(std::shared_ptr<TMailbox> mailbox);
+
+    void MigrateToThread(const TEdgeSlotThread* thread) {
+        MigrateToMailbox(thread->GetMailbox());
+    }
+
 private:
     void Unlink() noexcept {
         if (Monitor != nullptr)
@@ -444,27 +1020,306 @@ WEAK void TEdgeSlotThread::GrabObject(TEdgeSlotObject* obj) const {
 }
 
 
-class TObjectMessage: public IMessage {
+class TObjectMessage
+    : public IMessage
+    , public std::enable_shared_from_this<TObjectMessage>
+{
 public:
     TObjectMessage(TMonitorPtr link)
         : ObjectLink(std::move(link))
+        , Epoch(ObjectLink->GetEpoch())
     {}
 
+    // Enqueues carrier, this message or a message that wraps it, to the
+    // thread of the object. Returns false if the object has no thread.
+    bool SendAs(TMessagePtr carrier) {
+        return ObjectLink->Enqueue(std::move(carrier), &Epoch);
+    }
+
+    // Returns true if the message must not be consumed in the current
+    // thread. The object has moved since the message was sent and the
+    // carrier follows it, or the object is still moving and the carrier is
+    // held until the messages from the previous thread have arrived.
+    template <typename TCarrier>
+    bool Redirected(TCarrier* carrier) {
+        auto epoch = ObjectLink->GetEpoch();
+        if (NOWAY(epoch != Epoch)) {
+            // the object is not here any more, a carrier that can not
+            // follow it is dropped
+            if (!ObjectLink->SameMailbox()) {
+                FollowsObject = true;
+                SendAs(carrier->shared_from_this());
+                return true;
+            }
+            Epoch = epoch;
+        }
+        if (NOWAY(ObjectLink->IsFenced()) && !FollowsObject) {
+            ObjectLink->Hold(carrier->shared_from_this());
+            return true;
+        }
+        return false;
+    }
+
 protected:
     TMonitorPtr ObjectLink;
+    ui32 Epoch;
+    bool FollowsObject = false;
 
     void JustSend() {
-        auto mbox = ObjectLink->GetMailbox();
-        if (mbox.get() != nullptr)
-            mbox->enqueue(TMessagePtr(this));
-        else
-            delete this;
+        SendAs(TMessagePtr(this));
+    }
+};
+
+
+class TQuitMessage {
+public:
+};
+
+
+// Follows the messages for a moved object through its previous mailbox,
+// the new thread holds other messages for the object until it comes.
+class TFenceLiftMsg: public TObjectMessage {
+public:
+    TFenceLiftMsg(TMonitorPtr link, ui32 epoch)
+        : TObjectMessage(std::move(link))
+    {
+        Epoch = epoch;
+    }
+
+    virtual void Consume() override {
+        if (!ObjectLink->IsAlive() || Redirected(this))
+            return;
+        auto held = ObjectLink->TakeHeld();
+        ObjectLink->SetFenced(false);
+        for (auto& msg: held) {
+            try {
+                msg->Consume();
+            } catch (...) {
+            }
+        }
+    }
+};
+
+
+class TMigrateMsg: public TObjectMessage {
+public:
+    TMigrateMsg(TMonitorPtr link, std::shared_ptr<TMailbox> target)
+        : TObjectMessage(std::move(link))
+        , Target(std::move(target))
+    {}
+
+    virtual void Consume() override {
+        if (!ObjectLink->IsAlive() || Redirected(this))
+            return;
+        Migrate(ObjectLink, std::move(Target));
+    }
+
+    // moves the object behind the link in the thread it belongs to
+    static void Send(TMonitorPtr link, std::shared_ptr<TMailbox> target) {
+        if (link->SameMailbox() && !link->IsFenced()) {
+            Migrate(link, std::move(target));
+            return;
+        }
+        auto msg = new TMigrateMsg(std::move(link), std::move(target));
+        msg->JustSend();
+    }
+
+protected:
+    std::shared_ptr<TMailbox> Target;
+
+    // Senders enqueue under the monitor lock, so no message for the object
+    // gets to the old mailbox after the fence marker.
+    static void Migrate(const TMonitorPtr& link, std::shared_ptr<TMailbox> target) {
+        auto old = link->GetMailbox();
+        if (old == target || old.get() == nullptr || target.get() == nullptr)
+            return;
+        link->SetFenced(true);
+        auto old_epoch = link->GetEpoch();
+        link->SetMailbox(std::move(target));
+        old->enqueue(std::make_shared<TFenceLiftMsg>(link, old_epoch));
+    }
+};
+
+
+inline void TObjectAnchor::MigrateToMailbox(std::shared_ptr<TMailbox> mailbox) {
+    TMigrateMsg::Send(GetLink(), std::move(mailbox));
+}
+
+
+enum class BACKPRESSURE {
+    DROP,     // the signal is lost
+    CONFLATE, // the last signal is kept and sent when the window drains
+    REPORT,   // the signal is not sent and try_emit() returns false
+};
+
+
+// Credits of a queued connection, a credit is taken by each signal on the
+// way and given back by the consumer with an atomic decrement instead of
+// a message. Direct calls take no credit.
+template <typename...TParams>
+class TCreditWindow {
+public:
+    TCreditWindow(ui32 credits, BACKPRESSURE policy) noexcept
+        : Credits(credits)
+        , Policy(policy)
+    {}
+
+    ui32 GetCredits() const noexcept {
+        return Credits;
+    }
+
+    BACKPRESSURE GetPolicy() const noexcept {
+        return Policy;
+    }
+
+    ui32 GetInFlight() const noexcept {
+        return InFlight.load(std::memory_order_relaxed);
+    }
+
+    ui64 GetDropped() const noexcept {
+        return Dropped.load(std::memory_order_relaxed);
+    }
+
+    ui64 GetConflated() const noexcept {
+        return Conflated.load(std::memory_order_relaxed);
+    }
+
+    ui64 GetRefused() const noexcept {
+        return Refused.load(std::memory_order_relaxed);
+    }
+
+    // called by emit, false if the signal must not be sent now, deadline
+    // is kept with a conflated signal
+    bool Acquire(ui64 deadline, const TParams&...params) {
+        if (TryTake()) {
+            if (HasLatest.load(std::memory_order_acquire))
+                DropLatest(true);
+            return true;
+        }
+
+        switch (Policy) {
+        case BACKPRESSURE::DROP:
+            Dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case BACKPRESSURE::REPORT:
+            Refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case BACKPRESSURE::CONFLATE:
+            break;
+        }
+
+        {
+            TWriteGuard guard(&Lock);
+            if (Latest)
+                Conflated.fetch_add(1, std::memory_order_relaxed);
+            Latest.reset(new std::tuple<TParams...>(params...));
+            LatestDeadline = deadline;
+            HasLatest.store(true, std::memory_order_seq_cst);
+        }
+        // the window may have drained before the signal was kept, pairs
+        // with Release()
+        if (InFlight.load(std::memory_order_seq_cst) != 0 || !TryTake())
+            return false;
+        // the kept signal is this one, it goes now and is not conflated
+        if (DropLatest(false))
+            return true;
+        // the consumer has taken it
+        Release();
+        return false;
+    }
+
+    // called by the consumer, true if the window has drained and there is
+    // a conflated signal to take
+    bool Release() noexcept {
+        auto left = InFlight.fetch_sub(1, std::memory_order_seq_cst) - 1;
+        return left == 0 && HasLatest.load(std::memory_order_seq_cst);
+    }
+
+    bool TakeLatest(std::tuple<TParams...>* latest, ui64* deadline) {
+        TWriteGuard guard(&Lock);
+        if (!Latest)
+            return false;
+        *latest = std::move(*Latest);
+        *deadline = LatestDeadline;
+        Latest.reset();
+        HasLatest.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+protected:
+    const ui32 Credits;
+    const BACKPRESSURE Policy;
+    std::atomic<ui32> InFlight = {0};
+    std::atomic<bool> HasLatest = {false};
+    std::atomic<ui64> Dropped = {0};
+    std::atomic<ui64> Conflated = {0};
+    std::atomic<ui64> Refused = {0};
+    TSpinRWLock Lock;
+    std::unique_ptr<std::tuple<TParams...>> Latest;
+    ui64 LatestDeadline = 0;
+
+    bool TryTake() noexcept {
+        auto taken = InFlight.load(std::memory_order_relaxed);
+        do {
+            if (taken >= Credits)
+                return false;
+        } while (!InFlight.compare_exchange_weak(
+                    taken, taken + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed));
+        return true;
+    }
+
+    bool DropLatest(bool conflated) {
+        TWriteGuard guard(&Lock);
+        if (!Latest)
+            return false;
+        if (conflated)
+            Conflated.fetch_add(1, std::memory_order_relaxed);
+        Latest.reset();
+        HasLatest.store(false, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+
+// Shared by both halves of a connection and its queued signals. The
+// connection is revoked as soon as either half is removed, a revoked
+// signal is dropped unconsumed.
+class TLinkStamp {
+public:
+    bool IsRevoked() const noexcept {
+        return Revoked.load(std::memory_order_acquire);
+    }
+
+    void Revoke() noexcept {
+        Revoked.store(true, std::memory_order_release);
     }
+
+protected:
+    std::atomic<bool> Revoked = {false};
 };
 
 
-class TQuitMessage {
-public:
+using TLinkStampPtr = std::shared_ptr<TLinkStamp>;
+
+
+inline void Revoke(const TLinkStampPtr& stamp) noexcept {
+    if (stamp)
+        stamp->Revoke();
+}
+
+
+// Options of a connection, kept by its edge.
+template <typename...TParams>
+struct TConnectOptions {
+    TSignalFilter<TParams...> Filter;
+    // see ConnectWithCredits()
+    std::shared_ptr<TCreditWindow<TParams...>> Credits;
+    // microseconds a queued signal stays useful, the consumer drops it
+    // unconsumed later on, 0 means forever
+    ui64 Ttl = 0;
+    // set by connect() and connect_once()
+    TLinkStampPtr Stamp;
 };
 
 
@@ -476,11 +1331,36 @@ public:
         , ParamsTuple(slot, std::forward<TParams>(params)...)
     {}
 
+    TSignal(TMonitorPtr link,
+            TLinkStampPtr stamp,
+            TSlot<TParams...>* slot,
+            TParams...params)
+        : TObjectMessage(std::move(link))
+        , Stamp(std::move(stamp))
+        , ParamsTuple(slot, std::forward<TParams>(params)...)
+    {}
+
     virtual void Consume() override {
-        if (ObjectLink->IsAlive())
+        if (IsAlive() && !Redirected(this))
             ApplyFunction(ConsumeImpl, ParamsTuple);
     }
 
+    // calls the slot directly if its object is in the current thread,
+    // queues the signal to the thread of the object otherwise
+    static void Deliver(
+            TMonitorPtr link, TSlot<TParams...>* slot, TParams...params)
+    {
+        if (!link->IsAlive())
+            return;
+        if (link->SameMailbox() && !link->IsFenced()) {
+            slot->receive(std::forward<TParams>(params)...);
+            return;
+        }
+        auto msg = new TSignal(
+            std::move(link), slot, std::forward<TParams>(params)...);
+        msg->JustSend();
+    }
+
     static void ConsumeImpl(
             TSlot<TParams...>* slot,
             TParams... params) noexcept
@@ -489,8 +1369,14 @@ public:
     }
 
 protected:
+    TLinkStampPtr Stamp;
     std::tuple<TSlot<TParams...>*, TParams...> ParamsTuple;
 
+    // the object is alive and the connection has not been removed
+    bool IsAlive() const noexcept {
+        return ObjectLink->IsAlive() && !(Stamp && Stamp->IsRevoked());
+    }
+
     template <class F, class Tuple, std::size_t... I>
     static void ApplyImpl(F&& f, Tuple&& t, std::index_sequence<I...>) {
         return std::forward<F>(f)(std::get<I>(std::forward<Tuple>(t))...);
@@ -506,24 +1392,154 @@ protected:
 };
 
 
-class TBlockSignal: public IMessage {
+// A signal of a connection with a credit window or a TTL. The credit is
+// given back when the signal is gone, a conflated signal is delivered
+// right after the one that has drained the window.
+template <typename...TParams>
+class TLimitedSignal: public TSignal<TParams...> {
+public:
+    TLimitedSignal(TMonitorPtr link,
+                   TLinkStampPtr stamp,
+                   TSlot<TParams...>* slot,
+                   std::shared_ptr<TCreditWindow<TParams...>> window,
+                   ui64 deadline,
+                   TParams...params)
+        : TSignal<TParams...>(std::move(link), std::move(stamp), slot,
+                              std::forward<TParams>(params)...)
+        , Window(std::move(window))
+        , Deadline(deadline)
+    {}
+
+    ~TLimitedSignal() {
+        if (Window)
+            Window->Release();
+    }
+
+    virtual void Consume() override {
+        if (!this->IsAlive() || this->Redirected(this))
+            return;
+        if (Expired(Deadline))
+            ++TEdgeSlotThread::LoopStats.ExpiredSignals;
+        else
+            this->ApplyFunction(
+                TSignal<TParams...>::ConsumeImpl, this->ParamsTuple);
+
+        if (!Window)
+            return;
+        auto window = std::move(Window);
+        if (!window->Release())
+            return;
+        std::tuple<TParams...> latest;
+        ui64 deadline = 0;
+        if (!window->TakeLatest(&latest, &deadline))
+            return;
+        if (Expired(deadline))
+            ++TEdgeSlotThread::LoopStats.ExpiredSignals;
+        else
+            this->ApplyFunction(
+                TSignal<TParams...>::ConsumeImpl,
+                std::tuple_cat(
+                    std::make_tuple(std::get<0>(this->ParamsTuple)),
+                    std::move(latest)));
+    }
+
+protected:
+    std::shared_ptr<TCreditWindow<TParams...>> Window;
+    ui64 Deadline;
+
+    static bool Expired(ui64 deadline) {
+        return deadline != 0 &&
+            TEdgeSlotThread::GetMonotonicLoopNow() > deadline;
+    }
+};
+
+
+// A latch of TBlockBatch. The sender that runs its message loop while
+// waiting is woken by a message to its mailbox.
+struct TBlockLatch: public TCountdownLatch {
+    std::shared_ptr<TMailbox> Notify;
+};
+
+
+class TWakeupMessage: public IMessage {
+public:
+    virtual void Consume() override {}
+};
+
+
+class TBlockSignal
+    : public IMessage
+    , public std::enable_shared_from_this<TBlockSignal>
+{
 public:
-    TBlockSignal(TMessagePtr payload)
+    TBlockSignal(std::shared_ptr<TObjectMessage> payload, TBlockLatch* latch)
         : Payload(std::move(payload))
+        , Latch(latch)
     {}
 
+    // a signal dropped on the way does not keep the sender waiting
+    ~TBlockSignal() {
+        Release();
+    }
+
     virtual void Consume() override {
+        if (Payload->Redirected(this))
+            return;
         Payload->Consume();
-        Event.Post();
+        Release();
+    }
+
+protected:
+    std::shared_ptr<TObjectMessage> Payload;
+    TBlockLatch* Latch;
+
+    void Release() noexcept {
+        if (Latch == nullptr)
+            return;
+        auto latch = Latch;
+        Latch = nullptr;
+        // the latch may be reused as soon as it is done
+        auto notify = latch->Notify;
+        if (latch->CountDown() && notify)
+            notify->enqueue(std::make_shared<TWakeupMessage>());
     }
+};
 
-    void Wait() noexcept {
-        Event.Wait();
+
+// The BLOCK_QUEUE signals of one emit. All of them are queued first, then
+// the sender waits once until every one has been consumed. Latches are
+// kept by the thread and reused by the next emits.
+class TBlockBatch {
+public:
+    TBlockBatch() = default;
+
+    TBlockBatch(const TBlockBatch&) = delete;
+    void operator=(const TBlockBatch&) = delete;
+
+    ~TBlockBatch() {
+        Wait();
     }
 
+    // the latch for the next blocking signal
+    TBlockLatch* Add();
+
+    // Runs the message loop of the thread while waiting if
+    // TLoopPolicy::PumpDepth allows, so the slots may block on signals
+    // back to this thread. Other objects of the thread, the emitting one
+    // included, may get their messages before the emit returns.
+    void Wait() noexcept;
+
 protected:
-    TMessagePtr Payload;
-    TSemaphore Event;
+    TBlockLatch* Latch = nullptr;
+    bool Pumping = false;
+
+    static thread_local std::vector<std::unique_ptr<TBlockLatch>> Latches;
+    static thread_local size_t LatchesInUse;
+    static thread_local ui32 PumpLevel;
+
+    static bool CanPump() noexcept;
+
+    void Pump() noexcept;
 };
 
 
@@ -541,7 +1557,7 @@ public:
     {}
 
     virtual void Consume() override {
-        if (!ObjectLink->IsAlive())
+        if (!ObjectLink->IsAlive() || Redirected(this))
             return;
         Dest->half_disconnect(
             std::move(ObjectLink), std::move(ApartLink), Apart);
@@ -564,6 +1580,9 @@ enum class DELIVERY {
     DIRECT,
     QUEUE,
     BLOCK_QUEUE,
+    // queued to the thread-local run queue when the object is in the
+    // sending thread, as QUEUE otherwise
+    DEFERRED,
 };
 
 
@@ -574,17 +1593,22 @@ public:
                     TDest* dest,
                     TMonitorPtr apart_link,
                     TApart* apart,
-                    DELIVERY type = DELIVERY::AUTO)
+                    DELIVERY type = DELIVERY::AUTO,
+                    bool once = false,
+                    typename TDest::TLinkOptions options = {})
         : TObjectMessage(std::move(dest_link))
         , Dest(dest)
         , ApartLink(std::move(apart_link))
         , Apart(apart)
         , Type(type)
+        , Once(once)
+        , Options(std::move(options))
     {}
 
 
+    // a one-shot connection has no half on the other side
     virtual ~THalfConnectMsg() noexcept {
-        if (Delivered)
+        if (Delivered || Once)
             return;
         THalfDisconnectMsg<TApart, TDest>::Send(
             std::move(ApartLink), Apart, std::move(ObjectLink), Dest);
@@ -592,15 +1616,18 @@ public:
 
 
     virtual void Consume() override {
+        if (ObjectLink->IsAlive() && Redirected(this))
+            return;
         Delivered = true;
 
         if (ObjectLink->IsAlive()) {
             Dest->half_connect(
-                std::move(ObjectLink), std::move(ApartLink), Apart, Type);
+                std::move(ObjectLink), std::move(ApartLink), Apart, Type, Once,
+                std::move(Options));
             return;
         }
 
-        if (!ApartLink->IsAlive())
+        if (!ApartLink->IsAlive() || Once)
             return;
 
         THalfDisconnectMsg<TApart, TDest>::Send(
@@ -619,6 +1646,8 @@ protected:
     TMonitorPtr ApartLink;
     TApart* Apart;
     DELIVERY Type;
+    bool Once;
+    typename TDest::TLinkOptions Options;
     bool Delivered = false;
 };
 
@@ -630,18 +1659,21 @@ public:
                     TDest* dest,
                     TMonitorPtr apart_link,
                     TApart* apart,
-                    DELIVERY type = DELIVERY::AUTO)
+                    DELIVERY type = DELIVERY::AUTO,
+                    typename TDest::TLinkOptions options = {})
         : TObjectMessage(std::move(dest_link))
         , Dest(dest)
         , ApartLink(std::move(apart_link))
         , Apart(apart)
         , Type(type)
+        , Options(std::move(options))
     {}
 
     virtual void Consume() override {
-        if (!ObjectLink->IsAlive() || !ApartLink->IsAlive())
+        if (!ObjectLink->IsAlive() || !ApartLink->IsAlive() || Redirected(this))
             return;
-        Dest->connect(std::move(ObjectLink), std::move(ApartLink), Apart, Type);
+        Dest->connect(std::move(ObjectLink), std::move(ApartLink), Apart, Type,
+                      std::move(Options));
     }
 
     template <typename...Types>
@@ -654,6 +1686,7 @@ protected:
     TMonitorPtr ApartLink;
     TApart* Apart;
     DELIVERY Type;
+    typename TDest::TLinkOptions Options;
 };
 
 
@@ -671,7 +1704,7 @@ public:
     {}
 
     virtual void Consume() override {
-        if (!ObjectLink->IsAlive())
+        if (!ObjectLink->IsAlive() || Redirected(this))
             return;
         Dest->disconnect(std::move(ObjectLink), std::move(ApartLink), Apart);
     }
@@ -699,6 +1732,9 @@ protected:
 template <typename...TParams>
 class TSlot {
 public:
+    using TFilter = TSignalFilter<TParams...>;
+    using TLinkOptions = TConnectOptions<TParams...>;
+
     template <typename TObject>
     TSlot(TObject* object, TConnectCallee<TParams...> slot)
         : Object(object)
@@ -707,13 +1743,16 @@ public:
     {}
 
     ~TSlot() {
-        for (auto& i: SlotConnections)
+        for (auto& i: SlotConnections) {
+            Revoke(i.Stamp);
             i.Edge->half_disconnect(i.ObjectLink, TMonitorPtr(Link), this);
+        }
     }
 
     void disconnect(TMonitorPtr edge_link, TEdge<TParams...>* edge) {
         for (auto i = SlotConnections.begin(); i != SlotConnections.end(); ++i)
             if (i->Edge == edge && i->ObjectLink == edge_link) {
+                Revoke(i->Stamp);
                 edge->half_disconnect(
                         std::move(i->ObjectLink), TMonitorPtr(Link), this);
                 SlotConnections.erase(i);
@@ -738,6 +1777,7 @@ public:
                 ++i;
                 continue;
             }
+            Revoke(SlotConnections[i].Stamp);
             edge->half_disconnect(
                 std::move(SlotConnections[i].ObjectLink),
                 TMonitorPtr(Link),
@@ -749,6 +1789,7 @@ public:
     void disconnect_all() {
         for (auto i = SlotConnections.begin(); i != SlotConnections.end(); ++i)
         {
+            Revoke(i->Stamp);
             i->Edge->half_disconnect(
                     std::move(i->ObjectLink), TMonitorPtr(Link), this);
         }
@@ -758,14 +1799,18 @@ public:
     void connect(TMonitorPtr slot_link,
                  TMonitorPtr edge_link,
                  TEdge<TParams...>* edge,
-                 DELIVERY type = DELIVERY::AUTO)
+                 DELIVERY type = DELIVERY::AUTO,
+                 TLinkOptions options = {})
     {
         if (slot_link->SameMailbox()) {
-            half_connect(slot_link, edge_link, edge);
-            edge->half_connect(edge_link, slot_link, this, type);
+            options.Stamp = std::make_shared<TLinkStamp>();
+            half_connect(slot_link, edge_link, edge, type, false, options);
+            edge->half_connect(edge_link, slot_link, this, type, false,
+                               std::move(options));
         } else {
             TFullConnectMsg<TSlot<TParams...>, TEdge<TParams...>>::
-                Send(slot_link, this, edge_link, edge, type);
+                Send(slot_link, this, edge_link, edge, type,
+                     std::move(options));
         }
     }
 
@@ -794,28 +1839,35 @@ protected:
 
     void half_connect(TMonitorPtr edge_link,
                       TEdge<TParams...>* edge,
-                      DELIVERY = DELIVERY::AUTO)
+                      DELIVERY = DELIVERY::AUTO,
+                      bool = false,
+                      TLinkOptions options = {})
     {
-        SlotConnections.emplace_back(
-            TSlotConnection{std::move(edge_link), edge});
+        SlotConnections.emplace_back(TSlotConnection{
+            std::move(edge_link), edge, std::move(options.Stamp)});
     }
 
     void half_connect(TMonitorPtr slot_link,
                       TMonitorPtr edge_link,
                       TEdge<TParams...>* edge,
-                      DELIVERY = DELIVERY::AUTO)
+                      DELIVERY type = DELIVERY::AUTO,
+                      bool = false,
+                      TLinkOptions options = {})
     {
         if (slot_link->SameMailbox()) {
-            half_connect(std::move(edge_link), edge);
+            half_connect(std::move(edge_link), edge, type, false,
+                         std::move(options));
         } else {
             THalfConnectMsg<TSlot<TParams...>, TEdge<TParams...>>::
-                Send(std::move(slot_link), this, std::move(edge_link), edge);
+                Send(std::move(slot_link), this, std::move(edge_link), edge,
+                     type, false, std::move(options));
         }
     }
 
     void half_disconnect(TMonitorPtr edge_link, TEdge<TParams...>* edge) {
         for (auto i = SlotConnections.begin(); i != SlotConnections.end(); ++i)
             if (i->Edge == edge && i->ObjectLink == edge_link) {
+                Revoke(i->Stamp);
                 SlotConnections.erase(i);
                 break;
             }
@@ -839,6 +1891,7 @@ protected:
     struct TSlotConnection {
         TMonitorPtr ObjectLink;
         TEdge<TParams...>* Edge;
+        TLinkStampPtr Stamp;
     };
 
     void* Object;
@@ -861,71 +1914,53 @@ public:
     {}
 
     ~TEdge() {
-        for (const auto& i: EdgeConnections)
-            i.Slot->half_disconnect(
-                i.ObjectLink, TMonitorPtr(TSlot<TParams...>::Link), this);
+        for (const auto& i: EdgeConnections) {
+            Revoke(i.Stamp);
+            if (i.Slot != nullptr && !i.Once)
+                i.Slot->half_disconnect(
+                    i.ObjectLink, TMonitorPtr(TSlot<TParams...>::Link), this);
+        }
+    }
+
+    // true if some slot is connected, the connections disconnected while
+    // emitting are dropped at the end of emit()
+    bool has_slots() const noexcept {
+        return !EdgeConnections.empty();
     }
 
     void emit(TParams...params) const {
+        try_emit(params...);
+    }
+
+    // false if a connection with BACKPRESSURE::REPORT is out of credits,
+    // the other connections get the signal anyway
+    bool try_emit(TParams...params) const {
         DontErase = true;
         // do not emit signal to connections appeared while emitting
         auto size = EdgeConnections.size();
 
-        TMessagePtr msg;
-
+        bool sent = true;
+        bool fired = false;
+        TBlockBatch batch;
         for (size_t i = 0; i < size; ++i) {
             const auto& elem = EdgeConnections[i];
             if (elem.Slot == nullptr)
                 continue;
-            if (!elem.ObjectLink->IsAlive())
+            if (elem.Filter && !elem.Filter(params...))
+                continue;
+            if (!elem.Once) {
+                sent &= Deliver(elem, &batch, params...);
                 continue;
-
-            auto mbox = elem.ObjectLink->GetMailbox();
-
-            switch (elem.Type) {
-            case DELIVERY::AUTO:
-                if (mbox == TEdgeSlotThread::LocalMailbox) {
-                    elem.Slot->receive(params...);
-                    continue;
-                }
-                // fall through
-            case DELIVERY::QUEUE:
-                if (mbox.get() == nullptr)
-                    continue;
-
-                if (msg.get() == nullptr)
-                    msg = std::make_shared<TSignal<TParams...>>(
-                        elem.ObjectLink, elem.Slot, params...);
-
-                mbox->enqueue(msg);
-                break;
-
-            case DELIVERY::DIRECT:
-                elem.Slot->receive(params...);
-                break;
-
-            case DELIVERY::BLOCK_QUEUE:
-                if (mbox == TEdgeSlotThread::LocalMailbox) {
-                    elem.Slot->receive(params...);
-                    continue;
-                }
-
-                if (mbox.get() == nullptr)
-                    continue;
-
-                if (msg.get() == nullptr)
-                    msg = std::make_shared<TSignal<TParams...>>(
-                        elem.ObjectLink, elem.Slot, params...);
-
-                {
-                    std::shared_ptr<TBlockSignal> block =
-                            std::make_shared<TBlockSignal>(msg);
-                    mbox->enqueue(block);
-                    block->Wait();
-                }
-                break;
             }
+            if (!elem.Once->exchange(true, std::memory_order_acq_rel))
+                sent &= Deliver(elem, &batch, params...);
+            // the slot may have connected more and moved the vector
+            EdgeConnections[i].Slot = nullptr;
+            EdgeConnections[i].ObjectLink.reset();
+            NeedCleanup = true;
+            fired = true;
         }
+        batch.Wait();
 
         if (NeedCleanup) {
             for (size_t i = 0; i < EdgeConnections.size();)
@@ -937,16 +1972,21 @@ public:
         }
 
         DontErase = false;
+        if (fired)
+            const_cast<TEdge*>(this)->ConnectionsChanged();
+        return sent;
     }
 
 
     void disconnect(TSlot<TParams...>* slot) {
         for (auto i = EdgeConnections.begin(); i != EdgeConnections.end(); ++i)
             if (i->Slot == slot && !i->ObjectLink.empty()) {
-                slot->half_disconnect(
-                        std::move(i->ObjectLink),
-                        TMonitorPtr(TSlot<TParams...>::Link),
-                        this);
+                Revoke(i->Stamp);
+                if (!i->Once)
+                    slot->half_disconnect(
+                            std::move(i->ObjectLink),
+                            TMonitorPtr(TSlot<TParams...>::Link),
+                            this);
 
                 if (DontErase) {
                     i->Slot = nullptr;
@@ -955,6 +1995,7 @@ public:
                 } else {
                     EdgeConnections.erase(i);
                 }
+                ConnectionsChanged();
                 break;
             }
     }
@@ -963,10 +2004,12 @@ public:
     void disconnect(TMonitorPtr slot_link, TSlot<TParams...>* slot) {
         for (auto i = EdgeConnections.begin(); i != EdgeConnections.end(); ++i)
             if (i->Slot == slot && slot_link == i->ObjectLink) {
-                slot->half_disconnect(
-                        std::move(i->ObjectLink),
-                        TMonitorPtr(TSlot<TParams...>::Link),
-                        this);
+                Revoke(i->Stamp);
+                if (!i->Once)
+                    slot->half_disconnect(
+                            std::move(i->ObjectLink),
+                            TMonitorPtr(TSlot<TParams...>::Link),
+                            this);
 
                 if (DontErase) {
                     i->Slot = nullptr;
@@ -975,6 +2018,7 @@ public:
                 } else {
                     EdgeConnections.erase(i);
                 }
+                ConnectionsChanged();
                 break;
             }
     }
@@ -1005,10 +2049,12 @@ public:
                 continue;
             }
 
-            slot->half_disconnect(
-                std::move(elem.ObjectLink),
-                TMonitorPtr(TSlot<TParams...>::Link),
-                this);
+            Revoke(elem.Stamp);
+            if (!elem.Once)
+                slot->half_disconnect(
+                    std::move(elem.ObjectLink),
+                    TMonitorPtr(TSlot<TParams...>::Link),
+                    this);
 
             if (DontErase) {
                 elem.Slot = nullptr;
@@ -1019,6 +2065,7 @@ public:
                 EdgeConnections.erase(EdgeConnections.begin() + i);
             }
         }
+        ConnectionsChanged();
     }
 
     void disconnect_all_slots() {
@@ -1029,10 +2076,12 @@ public:
             if (i->Slot == nullptr)
                 continue;
 
-            i->Slot->half_disconnect(
-                i->ObjectLink,
-                TMonitorPtr(TSlot<TParams...>::Link),
-                this);
+            Revoke(i->Stamp);
+            if (!i->Once)
+                i->Slot->half_disconnect(
+                    i->ObjectLink,
+                    TMonitorPtr(TSlot<TParams...>::Link),
+                    this);
 
             if (!DontErase)
                 continue;
@@ -1044,6 +2093,7 @@ public:
             EdgeConnections.clear();
         else
             NeedCleanup = true;
+        ConnectionsChanged();
     }
 
     void disconnect_all_edges() {
@@ -1055,20 +2105,41 @@ public:
         disconnect_all_slots();
     }
 
+    using typename TSlot<TParams...>::TFilter;
+    using typename TSlot<TParams...>::TLinkOptions;
+
     void connect(TMonitorPtr edge_link,
                  TMonitorPtr slot_link,
                  TSlot<TParams...>* slot,
-                 DELIVERY type = DELIVERY::AUTO)
+                 DELIVERY type = DELIVERY::AUTO,
+                 TLinkOptions options = {})
     {
         if (edge_link->SameMailbox()) {
-            half_connect(edge_link, slot_link, slot, type);
-            slot->half_connect(slot_link, edge_link, this);
+            options.Stamp = std::make_shared<TLinkStamp>();
+            slot->half_connect(slot_link, edge_link, this, type, false,
+                               options);
+            half_connect(edge_link, slot_link, slot, type, false,
+                         std::move(options));
         } else {
             TFullConnectMsg<TEdge<TParams...>, TSlot<TParams...>>::
-                Send(edge_link, this, slot_link, slot, type);
+                Send(edge_link, this, slot_link, slot, type,
+                     std::move(options));
         }
     }
 
+    // The connection is kept by the edge only and is dropped when it
+    // fires, the slot is not told about it.
+    void connect_once(TMonitorPtr edge_link,
+                      TMonitorPtr slot_link,
+                      TSlot<TParams...>* slot,
+                      DELIVERY type = DELIVERY::AUTO,
+                      TLinkOptions options = {})
+    {
+        options.Stamp = std::make_shared<TLinkStamp>();
+        half_connect(std::move(edge_link), std::move(slot_link), slot, type,
+                     true, std::move(options));
+    }
+
 protected:
     template <typename...>
     friend class TSlot;
@@ -1089,23 +2160,48 @@ protected:
 
     void half_connect(TMonitorPtr slot_link,
                       TSlot<TParams...>* slot,
-                      DELIVERY type = DELIVERY::AUTO)
+                      DELIVERY type = DELIVERY::AUTO,
+                      bool once = false,
+                      TLinkOptions options = {})
     {
-        EdgeConnections.emplace_back(
-                TEdgeConnection{std::move(slot_link), slot, type});
+        if (!DontErase)
+            DropFired();
+        std::shared_ptr<std::atomic<bool>> fired;
+        if (once)
+            fired = std::make_shared<std::atomic<bool>>(false);
+        EdgeConnections.emplace_back(TEdgeConnection{
+            std::move(slot_link), slot, type, std::move(fired),
+            std::move(options.Filter), std::move(options.Credits),
+            options.Ttl, std::move(options.Stamp)});
+        ConnectionsChanged();
     }
 
     void half_connect(TMonitorPtr edge_link,
                       TMonitorPtr slot_link,
                       TSlot<TParams...>* slot,
-                      DELIVERY type = DELIVERY::AUTO)
+                      DELIVERY type = DELIVERY::AUTO,
+                      bool once = false,
+                      TLinkOptions options = {})
     {
         if (edge_link->SameMailbox())
-            half_connect(std::move(slot_link), slot, type);
+            half_connect(std::move(slot_link), slot, type, once,
+                         std::move(options));
         else
             THalfConnectMsg<TEdge<TParams...>, TSlot<TParams...>>::
                 Send(std::move(edge_link), this,
-                     std::move(slot_link), slot, type);
+                     std::move(slot_link), slot, type, once,
+                     std::move(options));
+    }
+
+    // one-shot connections fired by TSharedEdge from other threads
+    void DropFired() {
+        for (size_t i = 0; i < EdgeConnections.size();) {
+            const auto& once = EdgeConnections[i].Once;
+            if (once && once->load(std::memory_order_relaxed))
+                EdgeConnections.erase(EdgeConnections.begin() + i);
+            else
+                ++i;
+        }
     }
 
     void half_disconnect(TMonitorPtr slot_link, TSlot<TParams...>* slot) {
@@ -1117,6 +2213,9 @@ protected:
                 continue;
             if (i->ObjectLink != slot_link)
                 continue;
+            if (i->Once)
+                continue;
+            Revoke(i->Stamp);
             if (DontErase) {
                 i->Slot = nullptr;
                 i->ObjectLink.reset();
@@ -1124,6 +2223,7 @@ protected:
             } else {
                 EdgeConnections.erase(i);
             }
+            ConnectionsChanged();
             break;
         }
     }
@@ -1151,14 +2251,164 @@ protected:
         TMonitorPtr ObjectLink;
         TSlot<TParams...>* Slot;
         DELIVERY Type;
+        // set for one-shot connections, the first emit to claim it delivers
+        std::shared_ptr<std::atomic<bool>> Once;
+        TFilter Filter;
+        // bounds the signals queued to the slot
+        std::shared_ptr<TCreditWindow<TParams...>> Credits;
+        ui64 Ttl;
+        // revoked when the connection is removed, see TLinkStamp
+        TLinkStampPtr Stamp;
     };
 
+    // called in the thread of the edge after its connections have changed
+    virtual void ConnectionsChanged() {}
+
+    // a queued signal, nullptr if the connection is out of credits
+    static std::shared_ptr<TSignal<TParams...>>
+    MakeSignal(const TEdgeConnection& elem, const TParams&...params) {
+        if (!elem.Credits && elem.Ttl == 0)
+            return std::make_shared<TSignal<TParams...>>(
+                elem.ObjectLink, elem.Stamp, elem.Slot, params...);
+        auto deadline =
+            elem.Ttl != 0 ? TMonotonicClock::Now() + elem.Ttl : 0;
+        if (elem.Credits && !elem.Credits->Acquire(deadline, params...))
+            return nullptr;
+        return std::make_shared<TLimitedSignal<TParams...>>(
+            elem.ObjectLink, elem.Stamp, elem.Slot, elem.Credits, deadline,
+            params...);
+    }
+
+    // false if the signal is refused by BACKPRESSURE::REPORT
+    static bool Deliver(const TEdgeConnection& elem,
+                        TBlockBatch* batch,
+                        const TParams&...params)
+    {
+        if (!elem.ObjectLink->IsAlive())
+            return true;
+
+        if (auto sample = elem.ObjectLink->GetAffinitySample())
+            sample->Record(TEdgeSlotThread::LocalMailbox.get());
+
+        switch (elem.Type) {
+        case DELIVERY::AUTO:
+            // a moving object receives its signals in order, by queue
+            if (elem.ObjectLink->SameMailbox() &&
+                    !elem.ObjectLink->IsFenced()) {
+                elem.Slot->receive(params...);
+                return true;
+            }
+            // fall through
+        case DELIVERY::QUEUE:
+            {
+                auto msg = MakeSignal(elem, params...);
+                if (!msg)
+                    return elem.Credits->GetPolicy() != BACKPRESSURE::REPORT;
+                msg->SendAs(msg);
+            }
+            break;
+
+        case DELIVERY::DIRECT:
+            elem.Slot->receive(params...);
+            break;
+
+        case DELIVERY::BLOCK_QUEUE:
+            // the sender waits, so no credits are needed
+            if (elem.ObjectLink->SameMailbox()) {
+                elem.Slot->receive(params...);
+                return true;
+            }
+
+            {
+                auto msg = std::make_shared<TSignal<TParams...>>(
+                    elem.ObjectLink, elem.Stamp, elem.Slot, params...);
+                auto block = std::make_shared<TBlockSignal>(msg, batch->Add());
+                msg->SendAs(std::move(block));
+            }
+            break;
+
+        case DELIVERY::DEFERRED:
+            {
+                auto msg = MakeSignal(elem, params...);
+                if (!msg)
+                    return elem.Credits->GetPolicy() != BACKPRESSURE::REPORT;
+                if (elem.ObjectLink->SameMailbox() &&
+                        !elem.ObjectLink->IsFenced())
+                    TEdgeSlotThread::Defer(std::move(msg));
+                else
+                    msg->SendAs(msg);
+            }
+            break;
+        }
+        return true;
+    }
+
     mutable bool DontErase = false;
     mutable bool NeedCleanup = false;
     mutable std::vector<TEdgeConnection> EdgeConnections;
 };
 
 
+// An edge that may emit from any thread. Connections are changed in the
+// thread of the edge as usual, every change publishes a new snapshot of
+// them, and emit() delivers to the snapshot directly from the calling
+// thread without a hop through the thread of the edge.
+template <typename...TParams>
+class TSharedEdge: public TEdge<TParams...> {
+public:
+    template <typename TObject>
+    TSharedEdge(TObject* object)
+        : TEdge<TParams...>(object)
+        , Snapshot(std::make_shared<TConnections>())
+    {}
+
+    void emit(TParams...params) const {
+        try_emit(params...);
+    }
+
+    bool try_emit(TParams...params) const {
+        std::shared_ptr<const TConnections> snapshot;
+        {
+            TReadGuard guard(&SnapshotLock);
+            snapshot = Snapshot;
+        }
+        bool sent = true;
+        TBlockBatch batch;
+        for (const auto& elem: *snapshot) {
+            if (elem.Filter && !elem.Filter(params...))
+                continue;
+            if (elem.Once && elem.Once->exchange(true, std::memory_order_acq_rel))
+                continue;
+            sent &= TEdge<TParams...>::Deliver(elem, &batch, params...);
+        }
+        batch.Wait();
+        return sent;
+    }
+
+protected:
+    using TConnections =
+        std::vector<typename TEdge<TParams...>::TEdgeConnection>;
+
+    mutable TSpinRWLock SnapshotLock;
+    std::shared_ptr<const TConnections> Snapshot;
+
+    virtual void ConnectionsChanged() override {
+        std::shared_ptr<const TConnections> snapshot;
+        {
+            auto connections = std::make_shared<TConnections>();
+            for (const auto& elem: this->EdgeConnections)
+                if (elem.Slot != nullptr &&
+                        !(elem.Once && elem.Once->load(std::memory_order_relaxed)))
+                    connections->push_back(elem);
+            snapshot = std::move(connections);
+        }
+        TWriteGuard guard(&SnapshotLock);
+        // the previous snapshot is released after the lock
+        Snapshot.swap(snapshot);
+    }
+};
+
+
 template <typename TObject, typename...TParams>
 class TCallee {
 public:
@@ -1183,18 +2433,89 @@ TCallee<TObject, TParams...> GetCallee(void (TObject::*)(TParams...)) {
 }
 
 
+// filter(params...) is called by every emit before the signal is made,
+// so a rejected signal costs no message. With TSharedEdge it may be called
+// from several threads at once.
+template <typename TEdgeContainer, typename TSlotContainer, typename...TParams>
+void Connect(const TEdgeContainer* edge_object,
+             TEdge<TParams...>* edge,
+             const TSlotContainer* slot_object,
+             TSlot<TParams...>* slot,
+             DELIVERY type = DELIVERY::AUTO,
+             typename TSlot<TParams...>::TFilter filter = {})
+{
+    typename TSlot<TParams...>::TLinkOptions options;
+    options.Filter = std::move(filter);
+    edge->connect(
+        edge_object->GetAnchor().GetLink(),
+        slot_object->GetAnchor().GetLink(),
+        slot,
+        type,
+        std::move(options));
+}
+
+
+// a connection with a filter, credits or a TTL, see TConnectOptions
 template <typename TEdgeContainer, typename TSlotContainer, typename...TParams>
 void Connect(const TEdgeContainer* edge_object,
              TEdge<TParams...>* edge,
              const TSlotContainer* slot_object,
              TSlot<TParams...>* slot,
-             DELIVERY type = DELIVERY::AUTO)
+             DELIVERY type,
+             typename TSlot<TParams...>::TLinkOptions options)
+{
+    edge->connect(
+        edge_object->GetAnchor().GetLink(),
+        slot_object->GetAnchor().GetLink(),
+        slot,
+        type,
+        std::move(options));
+}
+
+
+// A queued connection that keeps at most credits signals on the way to
+// the slot, see BACKPRESSURE. Returns the window to watch its counters.
+template <typename TEdgeContainer, typename TSlotContainer, typename...TParams>
+std::shared_ptr<TCreditWindow<TParams...>>
+ConnectWithCredits(const TEdgeContainer* edge_object,
+                   TEdge<TParams...>* edge,
+                   const TSlotContainer* slot_object,
+                   TSlot<TParams...>* slot,
+                   ui32 credits,
+                   BACKPRESSURE policy,
+                   DELIVERY type = DELIVERY::AUTO)
 {
+    typename TSlot<TParams...>::TLinkOptions options;
+    options.Credits =
+        std::make_shared<TCreditWindow<TParams...>>(credits, policy);
     edge->connect(
         edge_object->GetAnchor().GetLink(),
         slot_object->GetAnchor().GetLink(),
         slot,
-        type);
+        type,
+        options);
+    return options.Credits;
+}
+
+
+// The slot gets only the next signal of the edge. There is no handshake
+// with the slot and no disconnect, see TEdge::connect_once().
+template <typename TEdgeContainer, typename TSlotContainer, typename...TParams>
+void ConnectOnce(const TEdgeContainer* edge_object,
+                 TEdge<TParams...>* edge,
+                 const TSlotContainer* slot_object,
+                 TSlot<TParams...>* slot,
+                 DELIVERY type = DELIVERY::AUTO,
+                 typename TSlot<TParams...>::TFilter filter = {})
+{
+    typename TSlot<TParams...>::TLinkOptions options;
+    options.Filter = std::move(filter);
+    edge->connect_once(
+        edge_object->GetAnchor().GetLink(),
+        slot_object->GetAnchor().GetLink(),
+        slot,
+        type,
+        std::move(options));
 }
 
 
@@ -1257,22 +2578,35 @@ protected:
 };
 
 
-class TEdgeSlotTimer: public TEdgeSlotObject {
+class TEdgeSlotTimer: public TEdgeSlotObject, public TTimerEntry {
 public:
     TEdgeSlotTimer(ui64 period = 0/* in microseconds */, bool repeat = false)
         : Period(period)
         , Repeat(repeat)
     {}
 
-    ui64 GetNextHitTime() const noexcept {
-        return NextHit;
+    ~TEdgeSlotTimer() {
+        if (IsQueued())
+            TEdgeSlotThread::UnregisterTimer(this);
+    }
+
+    // A timer may be delayed by up to slack microseconds to be fired
+    // together with other timers in one wakeup of the thread.
+    // Set it before activating the timer.
+    void SetSlack(ui64 slack) noexcept {
+        Slack = slack;
+    }
+
+    ui64 GetSlack() const noexcept {
+        return Slack;
+    }
+
+    void SetDriftPolicy(TIMER_DRIFT drift) noexcept {
+        Drift = drift;
     }
 
     static ui64 GetNow() {
-        timespec ts;
-        int res = ::clock_gettime(CLOCK_MONOTONIC, &ts);
-        ESyscallError::Validate(res, "clock_gettime");
-        return (ui64) ts.tv_sec * 1000000 + (ui64) ts.tv_nsec / 1000;
+        return TEdgeSlotThread::GetNow();
     }
 
     void Hit() {
@@ -1281,6 +2615,11 @@ public:
         Timeout.emit();
     }
 
+    virtual void Expire() override {
+        Hit();
+        Reregister();
+    }
+
     TEdge<> Timeout = TEdge<>(this);
 
     void Reregister() {
@@ -1288,6 +2627,14 @@ public:
             ActiveState.store(false, std::memory_order_release);
             return;
         }
+        if (Drift == TIMER_DRIFT::SKIP && Period != 0) {
+            auto now = TEdgeSlotThread::GetCachedNow();
+            if (NextHit + Period <= now) {
+                auto missed = (now - NextHit) / Period;
+                NextHit += missed * Period;
+                TEdgeSlotThread::RecordSkippedPeriods(missed);
+            }
+        }
         NextHit += Period;
         TEdgeSlotThread::RegisterTimer(this);
     }
@@ -1338,47 +2685,145 @@ public:
 
 protected:
     ui64 Period;
-    ui64 NextHit;
     bool Repeat;
+    TIMER_DRIFT Drift = TIMER_DRIFT::CATCH_UP;
     std::atomic<bool> ActiveState = {false};
 };
 
 
+class TCallbackTimer: public TTimerEntry {
+public:
+    virtual void Expire() override;
+
+protected:
+    TMonitorPtr Link;
+    TSlot<>* Slot = nullptr;
+    ui32 Index = 0; // position in the pool
+    ui32 Generation = 0;
+    ui32 NextFree = TTimerToken::NONE;
+
+    friend class TCallbackTimerPool;
+};
+
+
+// Thread local storage of TCallbackTimer entries, entries never move so
+// the timer heap may point to them. Tokens refer to entries by index and
+// generation, a generation changes every time an entry is released.
+class TCallbackTimerPool {
+public:
+    TTimerToken Allocate(
+            ui64 time, TMonitorPtr link, TSlot<>* slot, ui64 slack);
+
+    TCallbackTimer* Find(const TTimerToken& token) noexcept;
+
+    void Release(TCallbackTimer* timer) noexcept;
+
+    void Clear() noexcept;
+
+    size_t size() const noexcept {
+        return Used;
+    }
+
+protected:
+    static constexpr ui32 CHUNK_SIZE = 1024;
+
+    std::vector<std::unique_ptr<TCallbackTimer[]>> Chunks;
+    ui32 FreeHead = TTimerToken::NONE;
+    ui32 Constructed = 0;
+    size_t Used = 0;
+
+    TCallbackTimer* Get(ui32 index) noexcept {
+        return &Chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+    }
+};
+
+
+template <typename TObject>
+TTimerToken TEdgeSlotThread::ScheduleAfter(
+        ui64 delay, const TObject* object, TSlot<>* slot, ui64 slack)
+{
+    return ScheduleAt(
+        GetNow() + delay, object->GetAnchor().GetLink(), slot, slack);
+}
+
+
 template <typename Fn>
-void TEdgeSlotThread::MessageLoop(Fn&& condition) noexcept {
+bool TEdgeSlotThread::MessageLoop(Fn&& condition) noexcept {
+    bool timer_wakeup = false;
+    size_t deferred_quota = NEW_DEFERRED_RUN;
+
     for (;;) {
-        while (ActiveTimers.size() > 0) {
-            auto now = TEdgeSlotTimer::GetNow();
-            auto front_hit = ActiveTimers.front()->GetNextHitTime();
-            if (now < front_hit)
-                break;
-            auto timer = ActiveTimers.front();
-            ActiveTimers.erase(ActiveTimers.begin());
-            timer->Hit();
-            timer->Reregister();
+        bool now_is_fresh = false;
+        bool timers_left = false;
+        if (!ActiveTimers.empty()) {
+            timers_left = ExpireTimers(timer_wakeup);
+            now_is_fresh = true;
         }
+        timer_wakeup = false;
+        ++LoopStats.Iterations;
+        if (!now_is_fresh)
+            CachedNowStale = true;
 
         if (!condition())
-            return;
+            return false;
 
         TMessagePtr msg;
 
-        if (ActiveTimers.size() > 0) {
-            auto front_hit = ActiveTimers.front()->GetNextHitTime();
-            auto now = TEdgeSlotTimer::GetNow();
-            ui64 max_wait_time = front_hit - now;
-            msg = TEdgeSlotThread::LocalMailbox->dequeue(max_wait_time);
+        if (!DeferredMessages.empty()) {
+            // no need to wait, nullptr if the mailbox has had its turn
+            // empty, the deferred messages go next
+            msg = TryDequeue(&deferred_quota);
+            if (msg.get() == nullptr)
+                continue;
+        } else if (timers_left) {
+            // do not wait, the expired timers are still waiting
+            msg = LocalMailbox->try_dequeue();
+            if (msg.get() == nullptr)
+                continue;
+        } else if (LocalMailbox->IsBusyPolling()) {
+            msg = PollMailbox();
             if (msg.get() == nullptr)
                 continue;
+        } else if (!ActiveTimers.empty()) {
+            auto front_hit = ActiveTimers.top()->GetDeadline();
+            if (TimerFd && ClockIsMonotonic && LocalMailbox->IsPollable()) {
+                TimerFd->Arm(front_hit);
+                msg = LocalMailbox->dequeue(TimerFd.get());
+            } else {
+                auto now = now_is_fresh ? CachedNow : RefreshNow();
+                ui64 max_wait_time = front_hit > now ? front_hit - now : 0;
+                msg = LocalMailbox->dequeue(max_wait_time);
+            }
+            if (msg.get() == nullptr) {
+                timer_wakeup = !LocalMailbox->IsBusyPolling();
+                continue;
+            }
         } else {
             msg = TEdgeSlotThread::LocalMailbox->dequeue();
+            if (msg.get() == nullptr)
+                continue;
         }
 
-        try {
-            msg->Consume();
-        } catch (EQuitLoop&) {
-            return;
-        } catch (...) {
+        for (ui32 consumed = 1;; ++consumed) {
+            ++LoopStats.Messages;
+            try {
+                msg->Consume();
+            } catch (EQuitLoop&) {
+                return true;
+            } catch (...) {
+            }
+            msg.reset();
+
+            if (consumed == LoopPolicy.MessageBudget) {
+                if (!DeferredMessages.empty() || !LocalMailbox->empty())
+                    ++LoopStats.BudgetsExhausted;
+                break;
+            }
+            if (!condition())
+                return false;
+            msg = TryDequeue(&deferred_quota);
+            if (msg.get() == nullptr)
+                break;
         }
     }
 };
@@ -0,0 +1,150 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "edge_slot_balancer.hh"
+#include <algorithm>
+
+namespace bsc {
+
+
+TEdgeSlotBalancer::TEdgeSlotBalancer(const TOptions& options)
+    : Options(options)
+{
+    Connect(&Timer, &Timer.Timeout, this, &BalanceSlot);
+}
+
+
+void TEdgeSlotBalancer::AddMailbox(std::shared_ptr<TMailbox> mailbox) {
+    if (FindMailbox(mailbox.get()) == nullptr)
+        Mailboxes.push_back(std::move(mailbox));
+}
+
+
+void TEdgeSlotBalancer::Watch(TEdgeSlotObject* object) {
+    auto link = object->GetAnchor().GetLink();
+    link->EnableAffinitySample();
+    TWatched watched;
+    watched.Link = std::move(link);
+    Watched.push_back(std::move(watched));
+}
+
+
+const std::shared_ptr<TMailbox>*
+TEdgeSlotBalancer::FindMailbox(const TMailbox* mailbox) const {
+    for (auto& known: Mailboxes) {
+        if (known.get() == mailbox)
+            return &known;
+    }
+    return nullptr;
+}
+
+
+const std::shared_ptr<TMailbox>* TEdgeSlotBalancer::FindLeastLoaded() const {
+    const std::shared_ptr<TMailbox>* result = nullptr;
+    for (auto& mailbox: Mailboxes) {
+        if (result == nullptr || mailbox->GetDepth() < (*result)->GetDepth())
+            result = &mailbox;
+    }
+    return result;
+}
+
+
+bool TEdgeSlotBalancer::IsOverloaded(const TMailbox* mailbox) const noexcept {
+    return Options.OverloadDepth != 0 &&
+        mailbox->GetDepth() > Options.OverloadDepth;
+}
+
+
+const std::shared_ptr<TMailbox>*
+TEdgeSlotBalancer::ChooseByAffinity(TWatched* watched) {
+    auto sample = watched->Link->GetAffinitySample()->Take();
+    bool leads = sample.Signals >= Options.MinSignals &&
+        sample.Lead > 0 &&
+        (ui64) sample.Lead * 100 >= sample.Signals * Options.MinLead;
+
+    if (!leads) {
+        watched->Leader = nullptr;
+        watched->LeaderRounds = 0;
+        return nullptr;
+    }
+
+    // hysteresis: the same sender has to lead for several rounds
+    if (watched->Leader == sample.Candidate) {
+        ++watched->LeaderRounds;
+    } else {
+        watched->Leader = sample.Candidate;
+        watched->LeaderRounds = 1;
+    }
+    if (watched->LeaderRounds < Options.Rounds)
+        return nullptr;
+
+    auto target = FindMailbox(sample.Candidate);
+    if (target == nullptr || IsOverloaded(target->get()))
+        return nullptr;
+    return target;
+}
+
+
+void TEdgeSlotBalancer::Balance() {
+    ++Stats.Rounds;
+
+    Watched.erase(
+        std::remove_if(Watched.begin(), Watched.end(),
+            [](const TWatched& watched) { return !watched.Link->IsAlive(); }),
+        Watched.end());
+
+    // move at most one object away from every overloaded thread per round
+    std::vector<const TMailbox*> unloaded;
+
+    for (auto& watched: Watched) {
+        auto target = ChooseByAffinity(&watched);
+        if (watched.Cooldown != 0) {
+            --watched.Cooldown;
+            continue;
+        }
+
+        auto current = watched.Link->GetMailbox();
+        if (target != nullptr && target->get() != current.get()) {
+            ++Stats.AffinityMoves;
+        } else if (current.get() != nullptr && IsOverloaded(current.get()) &&
+                   FindMailbox(current.get()) != nullptr &&
+                   std::find(unloaded.begin(), unloaded.end(),
+                             current.get()) == unloaded.end()) {
+            target = FindLeastLoaded();
+            if (target->get()->GetDepth() * 2 >= current->GetDepth())
+                continue;
+            unloaded.push_back(current.get());
+            ++Stats.LoadMoves;
+        } else {
+            continue;
+        }
+
+        TMigrateMsg::Send(watched.Link, *target);
+        watched.Cooldown = Options.Cooldown;
+        watched.Leader = nullptr;
+        watched.LeaderRounds = 0;
+    }
+}
+
+
+} // namespace bsc
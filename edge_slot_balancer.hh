@@ -0,0 +1,114 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot.hh"
+
+
+namespace bsc {
+
+
+// Moves watched objects to the thread that sends them most of their
+// signals, so chatty pairs end up in one thread and talk by direct calls,
+// and moves objects away from threads with a deep mailbox. Only the
+// threads added to the balancer are considered as targets.
+//
+// Create the balancer in the thread that runs it, Start() activates a
+// timer of that thread. Balance() may also be called by hand.
+class TEdgeSlotBalancer: public TEdgeSlotObject {
+public:
+    struct TOptions {
+        ui64 Period = 100000; // microseconds between balancing rounds
+        // signals an object needs in a round to be moved by affinity
+        ui64 MinSignals = 100;
+        // the lead of the top sender in percent of the signals, a lead of
+        // 50 means the top sender sent about 3/4 of the signals
+        ui32 MinLead = 50;
+        // rounds in a row the same sender has to lead
+        ui32 Rounds = 2;
+        // rounds a moved object stays where it is
+        ui32 Cooldown = 10;
+        // mailbox depth of an overloaded thread, 0 disables load balancing
+        ui64 OverloadDepth = 0;
+    };
+
+    struct TStats {
+        ui64 Rounds = 0;
+        ui64 AffinityMoves = 0;
+        ui64 LoadMoves = 0;
+    };
+
+    TEdgeSlotBalancer()
+        : TEdgeSlotBalancer(TOptions())
+    {}
+
+    explicit TEdgeSlotBalancer(const TOptions& options);
+
+    void AddThread(const TEdgeSlotThread* thread) {
+        AddMailbox(thread->GetMailbox());
+    }
+
+    void AddMailbox(std::shared_ptr<TMailbox> mailbox);
+
+    // starts sampling the senders of the object
+    void Watch(TEdgeSlotObject* object);
+
+    void Start() {
+        Timer.Activate(Options.Period, true);
+    }
+
+    void Stop() {
+        Timer.Deactivate();
+    }
+
+    void Balance();
+
+    const TStats& GetStats() const noexcept {
+        return Stats;
+    }
+
+protected:
+    struct TWatched {
+        TMonitorPtr Link;
+        const TMailbox* Leader = nullptr;
+        ui32 LeaderRounds = 0;
+        ui32 Cooldown = 0;
+    };
+
+    const TOptions Options;
+    std::vector<std::shared_ptr<TMailbox>> Mailboxes;
+    std::vector<TWatched> Watched;
+    TStats Stats;
+    TEdgeSlotTimer Timer;
+
+    DEFINE_SLOT(TEdgeSlotBalancer, Balance, BalanceSlot);
+
+    const std::shared_ptr<TMailbox>* FindMailbox(const TMailbox* mailbox) const;
+    const std::shared_ptr<TMailbox>* FindLeastLoaded() const;
+    bool IsOverloaded(const TMailbox* mailbox) const noexcept;
+    const std::shared_ptr<TMailbox>* ChooseByAffinity(TWatched* watched);
+};
+
+
+} // namespace bsc
@@ -0,0 +1,346 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "edge_slot.hh"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+
+
+using namespace bsc;
+
+
+class TBenchTimer: public TTimerHeapHook {
+public:
+    ui64 GetDeadline() const noexcept {
+        return NextHit;
+    }
+
+    ui64 NextHit = 0;
+};
+
+
+// the timer store that TEdgeSlotThread used before TTimerHeap
+class TSortedTimerVector {
+public:
+    void push(TBenchTimer* timer) {
+        erase(timer);
+        for (auto i = Timers.begin(); i != Timers.end(); ++i) {
+            if (timer->GetDeadline() >= (*i)->GetDeadline())
+                continue;
+            Timers.insert(i, timer);
+            return;
+        }
+        Timers.push_back(timer);
+    }
+
+    bool erase(TBenchTimer* timer) {
+        for (auto i = Timers.begin(); i != Timers.end(); ++i) {
+            if (timer != *i)
+                continue;
+            Timers.erase(i);
+            return true;
+        }
+        return false;
+    }
+
+    TBenchTimer* top() const {
+        return Timers.front();
+    }
+
+    void pop() {
+        Timers.erase(Timers.begin());
+    }
+
+    void clear() {
+        Timers.clear();
+    }
+
+protected:
+    std::vector<TBenchTimer*> Timers;
+};
+
+
+// Models per-connection idle timers: most operations re-arm a random timer
+// (cancel + insert), the rest expire the earliest one and re-arm it.
+template <typename TStore>
+static double RunTimerStore(std::vector<TBenchTimer>& timers, ui64 ops) {
+    TStore store;
+    std::mt19937_64 rnd(42);
+    ui64 now = 0;
+
+    for (auto& timer: timers) {
+        timer.NextHit = now + rnd() % 1000000;
+        store.push(&timer);
+    }
+
+    auto start = TEdgeSlotTimer::GetNow();
+    for (ui64 i = 0; i < ops; ++i) {
+        TBenchTimer* timer;
+        if (i % 4 == 0) {
+            timer = store.top();
+            now = timer->NextHit;
+            store.pop();
+        } else {
+            timer = &timers[rnd() % timers.size()];
+            store.erase(timer);
+        }
+        timer->NextHit = now + rnd() % 1000000;
+        store.push(timer);
+    }
+    auto finish = TEdgeSlotTimer::GetNow();
+
+    store.clear();
+    return (finish - start) * 1000.0 / ops;
+}
+
+
+static void BenchTimerStores() {
+    printf("timer store: ns per operation (75%% re-arm, 25%% expire)\n");
+    printf("%10s %16s %16s\n", "timers", "sorted vector", "4-ary heap");
+
+    for (ui64 count: {4, 16, 64, 256, 1024, 4096, 16384, 100000}) {
+        std::vector<TBenchTimer> timers(count);
+        ui64 ops = 400000000 / (count + 1000);
+        if (ops > 2000000)
+            ops = 2000000;
+
+        auto vec = RunTimerStore<TSortedTimerVector>(timers, ops);
+        auto heap = RunTimerStore<TTimerHeap<TBenchTimer>>(timers, ops);
+        printf("%10lu %16.1f %16.1f\n", count, vec, heap);
+    }
+}
+
+
+class TBenchTimerCounter: public TEdgeSlotObject {
+public:
+    void hit() {
+        if (++Hits == Limit)
+            TEdgeSlotThread::PostSelfQuitMessage();
+    }
+
+    DEFINE_SLOT(TBenchTimerCounter, hit, Slot);
+
+    ui32 Hits = 0;
+    ui32 Limit = 0;
+};
+
+
+static void BenchTimerLateness(const char* name, TIMER_BACKEND backend) {
+    TEdgeSlotThread::LocalMailbox = std::make_shared<TMailbox>(
+            backend == TIMER_BACKEND::TIMERFD
+                ? MAILBOX_WAKEUP::EVENTFD
+                : MAILBOX_WAKEUP::SEMAPHORE);
+    TEdgeSlotThread::SetTimerBackend(backend);
+    TEdgeSlotThread::ResetTimerStats();
+
+    {
+        TEdgeSlotTimer timer(1000, true);
+        TBenchTimerCounter counter;
+        counter.Limit = 500;
+        Connect(&timer, &timer.Timeout, &counter, &counter.Slot);
+        timer.Activate();
+        TEdgeSlotThread::MessageLoop();
+        timer.Deactivate();
+    }
+
+    const auto& stats = TEdgeSlotThread::GetTimerStats();
+    printf("%14s %10lu %14.1f %14lu\n", name, stats.Hits,
+           (double) stats.TotalLateness / stats.Hits, stats.MaxLateness);
+
+    TEdgeSlotThread::CleanupTimers();
+}
+
+
+static void BenchTimerBackends() {
+    printf("timer lateness in microseconds, 1ms repeating timer\n");
+    printf("%14s %10s %14s %14s\n", "backend", "hits", "avg lateness",
+           "max lateness");
+    BenchTimerLateness("mailbox wait", TIMER_BACKEND::MAILBOX_WAIT);
+    BenchTimerLateness("timerfd", TIMER_BACKEND::TIMERFD);
+}
+
+
+template <typename Fn>
+static double MeasureClock(Fn&& read) {
+    constexpr ui64 reads = 10000000;
+    volatile ui64 sink = 0;
+    auto start = TMonotonicClock::NowNs();
+    for (ui64 i = 0; i < reads; ++i)
+        sink = sink + read();
+    auto finish = TMonotonicClock::NowNs();
+    return (double) (finish - start) / reads;
+}
+
+
+static void BenchClocks() {
+    TTscClock tsc;
+
+    printf("clock read: ns per call\n");
+    printf("%20s %10.1f\n", "CLOCK_MONOTONIC",
+           MeasureClock([]() { return TMonotonicClock::Now(); }));
+    printf("%20s %10.1f\n", "TTscClock",
+           MeasureClock([&]() { return tsc.GetNow(); }));
+    printf("%20s %10.1f\n", "cached loop time",
+           MeasureClock([]() { return TEdgeSlotThread::GetCachedNow(); }));
+}
+
+
+class TBenchSink: public TEdgeSlotObject {
+public:
+    void receive(int) {
+        Count.store(Count.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
+
+    DEFINE_SLOT(TBenchSink, receive, Slot);
+
+    std::atomic<ui64> Count = {0};
+};
+
+
+class TBenchSource: public TEdgeSlotObject {
+public:
+    TEdge<int> Edge = TEdge<int>(this);
+};
+
+
+// time from MigrateToThread() until the object has settled in the new
+// thread: the fence marker has come and held signals are delivered
+static void MeasureMigration(const char* name, bool loaded) {
+    constexpr ui32 moves = 2000;
+    TEdgeSlotThread first;
+    TEdgeSlotThread second;
+    TBenchSink sink;
+    TBenchSource source;
+    first.GrabObject(&sink);
+    Connect(&source, &source.Edge, &sink, &sink.Slot);
+
+    std::atomic<bool> done = {false};
+    std::thread producer([&]() {
+        // keep about a thousand signals on the way
+        for (ui64 sent = 0; loaded && !done.load(std::memory_order_relaxed);) {
+            if (sent - sink.Count.load(std::memory_order_relaxed) > 1000) {
+                std::this_thread::yield();
+                continue;
+            }
+            source.Edge.emit(0);
+            ++sent;
+        }
+    });
+
+    auto link = sink.GetAnchor().GetLink();
+    ui64 total = 0;
+    ui64 worst = 0;
+    for (ui32 i = 0; i < moves; ++i) {
+        auto target = i % 2 == 0 ? &second : &first;
+        auto start = TMonotonicClock::NowNs();
+        sink.GetAnchor().MigrateToThread(target);
+        while (link->GetMailbox() != target->GetMailbox() || link->IsFenced())
+            std::this_thread::yield();
+        auto latency = TMonotonicClock::NowNs() - start;
+        total += latency;
+        if (worst < latency)
+            worst = latency;
+    }
+
+    done = true;
+    producer.join();
+    printf("%14s %14.1f %14.1f\n", name, total / 1000.0 / moves, worst / 1000.0);
+
+    first.PostQuitMessage();
+    second.PostQuitMessage();
+    first.join();
+    second.join();
+}
+
+
+static void BenchMigration() {
+    printf("object migration latency in microseconds\n");
+    printf("%14s %14s %14s\n", "traffic", "avg", "max");
+    MeasureMigration("idle", false);
+    MeasureMigration("flooded", true);
+}
+
+
+// one-way latency of a signal to another thread, the sender spins until
+// the slot has been called
+static void MeasureSignalLatency(const char* name, bool busy_poll) {
+    constexpr ui32 signals = 20000;
+    TEdgeSlotThread::TOptions options;
+    options.BusyPoll = busy_poll;
+    options.LoopPolicy.BusyPollYield = 1000;
+    TEdgeSlotThread thread(options);
+    TBenchSink sink;
+    TBenchSource source;
+    thread.GrabObject(&sink);
+    Connect(&source, &source.Edge, &sink, &sink.Slot);
+
+    std::vector<ui64> latencies;
+    latencies.reserve(signals);
+    for (ui32 i = 0; i < signals; ++i) {
+        auto start = TMonotonicClock::NowNs();
+        source.Edge.emit(0);
+        while (sink.Count.load(std::memory_order_relaxed) == i)
+            CPU_RELAX();
+        latencies.push_back(TMonotonicClock::NowNs() - start);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%14s %14lu %14lu %14lu\n", name, latencies[signals / 2],
+           latencies[signals * 99 / 100], latencies.back());
+
+    thread.PostQuitMessage();
+    thread.join();
+}
+
+
+static void BenchWakeup() {
+    printf("signal latency in nanoseconds\n");
+    printf("%14s %14s %14s %14s\n", "consumer", "median", "99%", "max");
+    MeasureSignalLatency("waiting", false);
+    MeasureSignalLatency("busy polling", true);
+}
+
+
+int main(int ac, char** av) {
+    const char* filter = ac > 1 ? av[1] : "";
+
+    if (strstr("timers", filter) != nullptr)
+        BenchTimerStores();
+
+    if (strstr("lateness", filter) != nullptr)
+        BenchTimerBackends();
+
+    if (strstr("clock", filter) != nullptr)
+        BenchClocks();
+
+    if (strstr("migration", filter) != nullptr)
+        BenchMigration();
+
+    if (strstr("wakeup", filter) != nullptr)
+        BenchWakeup();
+
+    return 0;
+}
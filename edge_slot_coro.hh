@@ -0,0 +1,222 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot_reply.hh"
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <tuple>
+
+
+namespace bsc {
+
+
+// A coroutine that starts at once and is resumed by messages of the loop
+// that serves the thread where it waits. Nobody owns the coroutine, it
+// destroys itself when it finishes. There is nobody to take an exception
+// that leaves the coroutine, so it terminates the program, catch them in
+// the coroutine.
+class TTask {
+public:
+    struct promise_type {
+        TTask get_return_object() noexcept {
+            return TTask();
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {
+        }
+
+        [[noreturn]] void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+
+class TResumeMessage: public IMessage {
+public:
+    explicit TResumeMessage(std::coroutine_handle<> handle) noexcept
+        : Handle(handle)
+    {}
+
+    virtual void Consume() override {
+        Handle.resume();
+    }
+
+protected:
+    std::coroutine_handle<> Handle;
+};
+
+
+class TSwitchAwaiter {
+public:
+    explicit TSwitchAwaiter(std::shared_ptr<TMailbox> mailbox) noexcept
+        : Mailbox(std::move(mailbox))
+    {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        Mailbox->enqueue(std::make_shared<TResumeMessage>(handle));
+    }
+
+    void await_resume() const noexcept {
+    }
+
+protected:
+    std::shared_ptr<TMailbox> Mailbox;
+};
+
+
+// co_await ResumeIn(mailbox) moves the coroutine to the thread of mailbox,
+// with the local mailbox it lets the other messages go first.
+inline TSwitchAwaiter ResumeIn(std::shared_ptr<TMailbox> mailbox) noexcept {
+    return TSwitchAwaiter(std::move(mailbox));
+}
+
+
+// The awaiter of co_await future, the coroutine goes on in the thread
+// where it has been suspended. Gives a copy of the result or rethrows
+// the exception of the slot.
+template <typename TResult>
+class TFutureAwaiter {
+public:
+    explicit TFutureAwaiter(TFuture<TResult> future) noexcept
+        : Future(std::move(future))
+    {}
+
+    bool await_ready() const noexcept {
+        return Future.IsReady();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        Future.Then(TEdgeSlotThread::LocalMailbox,
+                    [handle](TFuture<TResult>) { handle.resume(); });
+    }
+
+    TResult await_resume() const {
+        return Future.Get();
+    }
+
+protected:
+    TFuture<TResult> Future;
+};
+
+
+template <typename TResult>
+TFutureAwaiter<TResult> operator co_await(TFuture<TResult> future) noexcept {
+    return TFutureAwaiter<TResult>(std::move(future));
+}
+
+
+// A slot to co_await signals of an edge. Connect it once, then each
+// co_await gives the params of the next signal as a tuple; signals that
+// come while nobody waits are kept in order. One coroutine may wait at a
+// time, it is resumed from the loop of the thread of this object, which
+// has to outlive the wait.
+template <typename...TParams>
+class TAwaitableSlot: public TEdgeSlotObject {
+public:
+    using TValue = std::tuple<std::decay_t<TParams>...>;
+
+    class TAwaiter {
+    public:
+        explicit TAwaiter(TAwaitableSlot* owner) noexcept
+            : Owner(owner)
+        {}
+
+        bool await_ready() {
+            if (Owner->Pending.empty())
+                return false;
+            Value.emplace(std::move(Owner->Pending.front()));
+            Owner->Pending.pop_front();
+            return true;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            Handle = handle;
+            Owner->Waiter = this;
+        }
+
+        TValue await_resume() {
+            return std::move(*Value);
+        }
+
+    protected:
+        TAwaitableSlot* Owner;
+        std::coroutine_handle<> Handle;
+        std::optional<TValue> Value;
+
+        friend class TAwaitableSlot;
+    };
+
+    TAwaiter operator co_await() noexcept {
+        return TAwaiter(this);
+    }
+
+    bool IsWaiting() const noexcept {
+        return Waiter != nullptr;
+    }
+
+    size_t GetPending() const noexcept {
+        return Pending.size();
+    }
+
+    void receive(TParams...params) {
+        if (!Waiter) {
+            Pending.emplace_back(std::forward<TParams>(params)...);
+            return;
+        }
+        auto waiter = Waiter;
+        Waiter = nullptr;
+        waiter->Value.emplace(std::forward<TParams>(params)...);
+        TEdgeSlotThread::Defer(
+            std::make_shared<TResumeMessage>(waiter->Handle));
+    }
+
+    DEFINE_SLOT(TAwaitableSlot, receive, Slot);
+
+protected:
+    TAwaiter* Waiter = nullptr;
+    std::deque<TValue> Pending;
+};
+
+
+} // namespace bsc
+
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,268 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "edge_slot_group.hh"
+#include <algorithm>
+
+namespace bsc {
+
+
+TEdgeSlotThreadGroup::TEdgeSlotThreadGroup(const TOptions& options)
+    : Options(options)
+{
+    auto count = std::max<size_t>(Options.MinThreads, 1);
+    for (size_t i = 0; i < count; ++i)
+        Spawn();
+    if (Options.Period != 0)
+        Control = std::thread(&TEdgeSlotThreadGroup::ControlLoop, this);
+}
+
+
+TEdgeSlotThreadGroup::~TEdgeSlotThreadGroup() {
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        Stopping = true;
+    }
+    Wakeup.notify_all();
+    if (Control.joinable())
+        Control.join();
+
+    for (auto list: {&Active, &Retiring}) {
+        for (auto& member: *list)
+            member.Thread->PostQuitMessage();
+        for (auto& member: *list)
+            member.Thread->join();
+    }
+}
+
+
+void TEdgeSlotThreadGroup::ControlLoop() {
+    std::unique_lock<std::mutex> guard(Lock);
+    while (!Stopping) {
+        Wakeup.wait_for(guard, std::chrono::microseconds(Options.Period));
+        if (Stopping)
+            break;
+        guard.unlock();
+        Adjust();
+        guard.lock();
+    }
+}
+
+
+void TEdgeSlotThreadGroup::GrabObject(TEdgeSlotObject* object) {
+    std::lock_guard<std::mutex> guard(Lock);
+    CountObjects();
+    auto member = FindLeastUsed();
+    member->Thread->GrabObject(object);
+    Objects.push_back(object->GetAnchor().GetLink());
+    ++member->Objects;
+}
+
+
+size_t TEdgeSlotThreadGroup::size() const {
+    std::lock_guard<std::mutex> guard(Lock);
+    return Active.size();
+}
+
+
+TEdgeSlotThreadGroup::TStats TEdgeSlotThreadGroup::GetStats() const {
+    std::lock_guard<std::mutex> guard(Lock);
+    return Stats;
+}
+
+
+void TEdgeSlotThreadGroup::Adjust() {
+    std::lock_guard<std::mutex> guard(Lock);
+    ++Stats.Adjustments;
+
+    FinishRetired();
+    CountObjects();
+
+    auto now = TMonotonicClock::Now();
+    ui64 depth = 0;
+    ui64 max_latency = 0;
+    for (auto& member: Active) {
+        auto mailbox = member.Thread->GetMailbox();
+        auto member_depth = mailbox->GetDepth();
+        auto dequeued = mailbox->GetDequeued();
+
+        // Little's law: time to consume the backlog at the recent rate,
+        // nothing consumed is a stall only if the backlog was there before
+        ui64 latency = 0;
+        if (member_depth != 0) {
+            auto consumed = dequeued - member.LastDequeued;
+            auto elapsed = now - member.LastCheck;
+            if (consumed != 0)
+                latency = member_depth * elapsed / consumed;
+            else if (member.LastDepth != 0)
+                latency = elapsed;
+        }
+
+        depth += member_depth;
+        max_latency = std::max(max_latency, latency);
+        member.LastDequeued = dequeued;
+        member.LastDepth = member_depth;
+        member.LastCheck = now;
+    }
+    Stats.MaxLatency = max_latency;
+
+    auto average = depth / Active.size();
+    bool overloaded = average > Options.GrowDepth ||
+        (Options.GrowLatency != 0 && max_latency > Options.GrowLatency);
+
+    if (overloaded) {
+        IdleRounds = 0;
+        if (Active.size() < Options.MaxThreads)
+            Spawn();
+        return;
+    }
+
+    if (average > Options.IdleDepth) {
+        IdleRounds = 0;
+        return;
+    }
+
+    if (++IdleRounds < Options.IdleRounds)
+        return;
+    IdleRounds = 0;
+    if (Active.size() > std::max<size_t>(Options.MinThreads, 1))
+        RetireOne();
+}
+
+
+void TEdgeSlotThreadGroup::CountObjects() {
+    Objects.erase(
+        std::remove_if(Objects.begin(), Objects.end(),
+            [](const TMonitorPtr& link) { return !link->IsAlive(); }),
+        Objects.end());
+
+    for (auto& member: Active)
+        member.Objects = 0;
+    for (auto& link: Objects) {
+        auto mailbox = link->GetMailbox();
+        for (auto& member: Active) {
+            if (member.Thread->GetMailbox() == mailbox) {
+                ++member.Objects;
+                break;
+            }
+        }
+    }
+}
+
+
+TEdgeSlotThreadGroup::TMember* TEdgeSlotThreadGroup::FindLeastUsed() {
+    TMember* result = nullptr;
+    for (auto& member: Active) {
+        if (result == nullptr || member.Objects < result->Objects)
+            result = &member;
+    }
+    return result;
+}
+
+
+void TEdgeSlotThreadGroup::Migrate(const TMonitorPtr& link, TMember* to) {
+    TMigrateMsg::Send(link, to->Thread->GetMailbox());
+    ++to->Objects;
+    ++Stats.Migrations;
+}
+
+
+void TEdgeSlotThreadGroup::Spawn() {
+    TMember member;
+    member.Thread.reset(new TEdgeSlotThread(Options.ThreadOptions));
+    member.LastCheck = TMonotonicClock::Now();
+    Active.push_back(std::move(member));
+    ++Stats.Spawned;
+    if (Active.size() == 1)
+        return;
+
+    // the new thread takes its share of objects from the busiest threads
+    // a link keeps its old mailbox until the move is consumed, so the
+    // links taken here are marked not to take them twice
+    auto& fresh = Active.back();
+    auto share = Objects.size() / Active.size();
+    std::vector<bool> taken(Objects.size(), false);
+    while (fresh.Objects < share) {
+        TMember* busiest = nullptr;
+        for (auto& other: Active) {
+            if (busiest == nullptr || other.Objects > busiest->Objects)
+                busiest = &other;
+        }
+        if (busiest == &fresh || busiest->Objects <= fresh.Objects + 1)
+            break;
+
+        auto mailbox = busiest->Thread->GetMailbox();
+        size_t i = 0;
+        for (; i < Objects.size(); ++i) {
+            const auto& link = Objects[i];
+            if (!taken[i] && link->GetMailbox() == mailbox &&
+                    !link->IsFenced())
+                break;
+        }
+        if (i == Objects.size())
+            break;
+        taken[i] = true;
+        Migrate(Objects[i], &fresh);
+        --busiest->Objects;
+    }
+}
+
+
+void TEdgeSlotThreadGroup::RetireOne() {
+    auto victim = std::min_element(Active.begin(), Active.end(),
+        [](const TMember& left, const TMember& right) {
+            return left.Objects < right.Objects;
+        });
+    Retiring.push_back(std::move(*victim));
+    Active.erase(victim);
+
+    auto mailbox = Retiring.back().Thread->GetMailbox();
+    for (auto& link: Objects) {
+        if (link->GetMailbox() == mailbox)
+            Migrate(link, FindLeastUsed());
+    }
+}
+
+
+void TEdgeSlotThreadGroup::FinishRetired() {
+    for (auto member = Retiring.begin(); member != Retiring.end();) {
+        auto mailbox = member->Thread->GetMailbox();
+        // a fenced object still waits for a marker from the old thread
+        bool settled = mailbox->GetDepth() == 0 &&
+            std::none_of(Objects.begin(), Objects.end(),
+                [&](const TMonitorPtr& link) {
+                    return link->GetMailbox() == mailbox || link->IsFenced();
+                });
+        if (!settled) {
+            ++member;
+            continue;
+        }
+        member->Thread->PostQuitMessage();
+        member->Thread->join();
+        member = Retiring.erase(member);
+        ++Stats.Retired;
+    }
+}
+
+
+} // namespace bsc
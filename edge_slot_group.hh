@@ -0,0 +1,122 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot.hh"
+#include <condition_variable>
+#include <mutex>
+
+
+namespace bsc {
+
+
+// A set of TEdgeSlotThread that grows when the mailboxes of its threads
+// fill up and shrinks when they stay empty. Objects grabbed by the group
+// are spread over its threads, later moves between the threads are made
+// by TMigrateMsg, which keeps the order of their signals.
+//
+// A thread is retired in two steps: its objects are moved away first, the
+// thread quits when all of them have settled in other threads and its
+// mailbox is empty.
+class TEdgeSlotThreadGroup {
+public:
+    struct TOptions {
+        size_t MinThreads = 1;
+        size_t MaxThreads = std::thread::hardware_concurrency();
+        // microseconds between checks, 0 means Adjust() is called by hand
+        ui64 Period = 100000;
+        // average mailbox depth per thread that adds a thread
+        ui64 GrowDepth = 1000;
+        // estimated queueing latency of a thread in microseconds that adds
+        // a thread, depth divided by the consume rate, 0 disables
+        ui64 GrowLatency = 10000;
+        // average mailbox depth per thread of an idle group
+        ui64 IdleDepth = 10;
+        // checks in a row the group has to be idle to retire a thread
+        ui32 IdleRounds = 10;
+        TEdgeSlotThread::TOptions ThreadOptions;
+    };
+
+    struct TStats {
+        ui64 Adjustments = 0;
+        ui64 Spawned = 0;
+        ui64 Retired = 0;
+        ui64 Migrations = 0;
+        ui64 MaxLatency = 0; // estimated by the last check, microseconds
+    };
+
+    TEdgeSlotThreadGroup()
+        : TEdgeSlotThreadGroup(TOptions())
+    {}
+
+    explicit TEdgeSlotThreadGroup(const TOptions& options);
+
+    ~TEdgeSlotThreadGroup();
+
+    TEdgeSlotThreadGroup(const TEdgeSlotThreadGroup&) = delete;
+    void operator=(const TEdgeSlotThreadGroup&) = delete;
+
+    // grabs the object to the thread with the fewest objects
+    void GrabObject(TEdgeSlotObject* object);
+
+    // one check of the load, called by the control thread every Period
+    void Adjust();
+
+    // active threads, retiring ones are not counted
+    size_t size() const;
+
+    TStats GetStats() const;
+
+protected:
+    struct TMember {
+        std::unique_ptr<TEdgeSlotThread> Thread;
+        ui64 LastDequeued = 0;
+        ui64 LastDepth = 0;
+        ui64 LastCheck = 0;
+        size_t Objects = 0;
+    };
+
+    const TOptions Options;
+    mutable std::mutex Lock;
+    std::vector<TMember> Active;
+    std::vector<TMember> Retiring;
+    std::vector<TMonitorPtr> Objects;
+    ui32 IdleRounds = 0;
+    TStats Stats;
+
+    std::thread Control;
+    std::condition_variable Wakeup;
+    bool Stopping = false;
+
+    void ControlLoop();
+    void CountObjects();
+    TMember* FindLeastUsed();
+    void Spawn();
+    void RetireOne();
+    void FinishRetired();
+    void Migrate(const TMonitorPtr& link, TMember* to);
+};
+
+
+} // namespace bsc
@@ -0,0 +1,217 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot.hh"
+#include <unordered_map>
+
+
+namespace bsc {
+
+
+template <typename TKey, typename...TParams>
+class TKeyedEdge;
+
+
+template <typename TKey, typename...TParams>
+class TKeyedSubscribeMsg: public TObjectMessage {
+public:
+    TKeyedSubscribeMsg(TMonitorPtr edge_link,
+                       TKeyedEdge<TKey, TParams...>* edge,
+                       TKey key,
+                       TMonitorPtr slot_link,
+                       TSlot<TKey, TParams...>* slot,
+                       DELIVERY type,
+                       bool subscribe)
+        : TObjectMessage(std::move(edge_link))
+        , Edge(edge)
+        , Key(std::move(key))
+        , SlotLink(std::move(slot_link))
+        , Slot(slot)
+        , Type(type)
+        , Subscribe(subscribe)
+    {}
+
+    virtual void Consume() override {
+        if (!ObjectLink->IsAlive() || Redirected(this))
+            return;
+        if (Subscribe)
+            Edge->connect(std::move(ObjectLink), Key,
+                          std::move(SlotLink), Slot, Type);
+        else
+            Edge->disconnect(std::move(ObjectLink), Key,
+                             std::move(SlotLink), Slot);
+    }
+
+    template <typename...Types>
+    static void Send(Types&&...params) {
+        auto msg = new TKeyedSubscribeMsg(std::forward<Types>(params)...);
+        msg->JustSend();
+    }
+
+protected:
+    TKeyedEdge<TKey, TParams...>* Edge;
+    TKey Key;
+    TMonitorPtr SlotLink;
+    TSlot<TKey, TParams...>* Slot;
+    DELIVERY Type;
+    bool Subscribe;
+};
+
+
+// An edge that routes a signal by its key. Every key has an edge of its
+// own found through a hash index, so emit() costs as much as the slots
+// subscribed to the key plus the slots subscribed to any key. Slots get
+// the key as the first param. The index lives in the thread of the edge,
+// subscriptions from other threads are queued there.
+template <typename TKey, typename...TParams>
+class TKeyedEdge {
+public:
+    using TKeyType = TKey;
+    using TKeySlot = TSlot<TKey, TParams...>;
+
+    template <typename TObject>
+    explicit TKeyedEdge(TObject* object)
+        : Owner(static_cast<TEdgeSlotObject*>(object))
+        , Any(object)
+    {}
+
+    TKeyedEdge(const TKeyedEdge&) = delete;
+    void operator=(const TKeyedEdge&) = delete;
+
+    void emit(const TKey& key, TParams...params) const {
+        auto i = Keys.find(key);
+        if (i != Keys.end()) {
+            // the slots of the key are gone
+            if (!i->second->has_slots())
+                Keys.erase(i);
+            else
+                i->second->emit(key, params...);
+        }
+        Any.emit(key, params...);
+    }
+
+    void connect(TMonitorPtr edge_link,
+                 const TKey& key,
+                 TMonitorPtr slot_link,
+                 TKeySlot* slot,
+                 DELIVERY type = DELIVERY::AUTO)
+    {
+        if (!edge_link->SameMailbox()) {
+            TKeyedSubscribeMsg<TKey, TParams...>::Send(
+                std::move(edge_link), this, key, std::move(slot_link), slot,
+                type, true);
+            return;
+        }
+        auto& edge = Keys[key];
+        if (!edge)
+            edge.reset(new TEdge<TKey, TParams...>(Owner));
+        edge->connect(std::move(edge_link), std::move(slot_link), slot, type);
+    }
+
+    void disconnect(TMonitorPtr edge_link,
+                    const TKey& key,
+                    TMonitorPtr slot_link,
+                    TKeySlot* slot)
+    {
+        if (!edge_link->SameMailbox()) {
+            TKeyedSubscribeMsg<TKey, TParams...>::Send(
+                std::move(edge_link), this, key, std::move(slot_link), slot,
+                DELIVERY::AUTO, false);
+            return;
+        }
+        auto i = Keys.find(key);
+        if (i == Keys.end())
+            return;
+        i->second->disconnect(std::move(slot_link), slot);
+        if (!i->second->has_slots())
+            Keys.erase(i);
+    }
+
+    // the edge for slots that get every key
+    TEdge<TKey, TParams...>* any() noexcept {
+        return &Any;
+    }
+
+    // keys with subscribers, call in the thread of the edge
+    size_t GetKeyCount() const noexcept {
+        return Keys.size();
+    }
+
+protected:
+    TEdgeSlotObject* Owner;
+    TEdge<TKey, TParams...> Any;
+    mutable std::unordered_map<
+        TKey, std::unique_ptr<TEdge<TKey, TParams...>>> Keys;
+};
+
+
+template <typename TEdgeContainer, typename TSlotContainer,
+          typename TKey, typename...TParams>
+void ConnectKey(const TEdgeContainer* edge_object,
+                TKeyedEdge<TKey, TParams...>* edge,
+                const typename TKeyedEdge<TKey, TParams...>::TKeyType& key,
+                const TSlotContainer* slot_object,
+                TSlot<TKey, TParams...>* slot,
+                DELIVERY type = DELIVERY::AUTO)
+{
+    edge->connect(
+        edge_object->GetAnchor().GetLink(),
+        key,
+        slot_object->GetAnchor().GetLink(),
+        slot,
+        type);
+}
+
+
+template <typename TEdgeContainer, typename TSlotContainer,
+          typename TKey, typename...TParams>
+void DisconnectKey(const TEdgeContainer* edge_object,
+                   TKeyedEdge<TKey, TParams...>* edge,
+                   const typename TKeyedEdge<TKey, TParams...>::TKeyType& key,
+                   const TSlotContainer* slot_object,
+                   TSlot<TKey, TParams...>* slot)
+{
+    edge->disconnect(
+        edge_object->GetAnchor().GetLink(),
+        key,
+        slot_object->GetAnchor().GetLink(),
+        slot);
+}
+
+
+// a wildcard subscription, Disconnect() it from edge->any()
+template <typename TEdgeContainer, typename TSlotContainer,
+          typename TKey, typename...TParams>
+void ConnectAnyKey(const TEdgeContainer* edge_object,
+                   TKeyedEdge<TKey, TParams...>* edge,
+                   const TSlotContainer* slot_object,
+                   TSlot<TKey, TParams...>* slot,
+                   DELIVERY type = DELIVERY::AUTO)
+{
+    Connect(edge_object, edge->any(), slot_object, slot, type);
+}
+
+
+} // namespace bsc
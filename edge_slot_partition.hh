@@ -0,0 +1,129 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot.hh"
+#include <functional>
+
+
+namespace bsc {
+
+
+// A slot that spreads signals over replicas of TReplica, each one in a
+// TEdgeSlotThread of its own. The replica is chosen by the hash of the
+// param KeyIndex, so signals with the same key keep their order.
+//
+// The partition is picked in the thread that calls the slot and the
+// signal goes straight to the thread of the replica through a
+// TSharedEdge, so connect it by AUTO from the thread of the sources or by
+// DIRECT to save a hop.
+template <typename TReplica, size_t KeyIndex, typename...TParams>
+class TPartitionedSlot: public TEdgeSlotObject {
+public:
+    static_assert(KeyIndex < sizeof...(TParams), "no such key param");
+
+    struct TOptions {
+        size_t Partitions = std::thread::hardware_concurrency();
+        TEdgeSlotThread::TOptions ThreadOptions;
+    };
+
+    using TFactory = std::function<std::unique_ptr<TReplica>(size_t)>;
+
+    // replicas are default constructed
+    explicit TPartitionedSlot(TSlot<TParams...> TReplica::* slot,
+                              const TOptions& options = TOptions())
+        : TPartitionedSlot(slot, options, &MakeReplica)
+    {}
+
+    // replicas are made by factory(index)
+    TPartitionedSlot(TSlot<TParams...> TReplica::* slot,
+                     const TOptions& options,
+                     TFactory factory)
+    {
+        auto count = options.Partitions > 0 ? options.Partitions : 1;
+        Partitions.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            TPartition part;
+            part.Thread.reset(new TEdgeSlotThread(options.ThreadOptions));
+            part.Replica = factory(i);
+            part.Edge.reset(new TSharedEdge<TParams...>(this));
+            part.Thread->GrabObject(part.Replica.get());
+            Connect(this, part.Edge.get(),
+                    part.Replica.get(), &(part.Replica.get()->*slot));
+            Partitions.push_back(std::move(part));
+        }
+    }
+
+    ~TPartitionedSlot() {
+        // the replicas get their disconnections before the quit message
+        for (auto& part: Partitions)
+            part.Edge->disconnect_all_slots();
+        for (auto& part: Partitions)
+            part.Thread->PostQuitMessage();
+        for (auto& part: Partitions)
+            part.Thread->join();
+    }
+
+    void receive(TParams...params) {
+        const auto& key = std::get<KeyIndex>(std::tie(params...));
+        Partitions[GetPartition(key)].Edge->emit(params...);
+    }
+
+    DEFINE_SLOT(TPartitionedSlot, receive, Slot);
+
+    template <typename TKey>
+    size_t GetPartition(const TKey& key) const {
+        return std::hash<TKey>()(key) % Partitions.size();
+    }
+
+    size_t size() const noexcept {
+        return Partitions.size();
+    }
+
+    // touch a replica in its own thread only, or after the threads quit
+    TReplica* GetReplica(size_t index) const noexcept {
+        return Partitions[index].Replica.get();
+    }
+
+    TEdgeSlotThread* GetThread(size_t index) const noexcept {
+        return Partitions[index].Thread.get();
+    }
+
+protected:
+    // the replica is destroyed before the edge it may still refer to
+    struct TPartition {
+        std::unique_ptr<TEdgeSlotThread> Thread;
+        std::unique_ptr<TSharedEdge<TParams...>> Edge;
+        std::unique_ptr<TReplica> Replica;
+    };
+
+    std::vector<TPartition> Partitions;
+
+    static std::unique_ptr<TReplica> MakeReplica(size_t) {
+        return std::unique_ptr<TReplica>(new TReplica());
+    }
+};
+
+
+} // namespace bsc
@@ -0,0 +1,201 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "edge_slot_pool.hh"
+
+namespace bsc {
+
+thread_local TStrandScheduler* TStrandScheduler::CurrentScheduler = nullptr;
+
+thread_local size_t TStrandScheduler::CurrentWorker = 0;
+
+
+bool TStrand::Run(
+        ui32 budget, const std::shared_ptr<TMailbox>& worker_mailbox)
+{
+    auto self = std::move(SelfRef);
+    TEdgeSlotThread::LocalMailbox = self;
+
+    ui64 done = 0;
+    TMessagePtr msg;
+    while (done < budget && Pop(&msg)) {
+        ++done;
+        TEdgeSlotThread::InvalidateNow();
+        try {
+            msg->Consume();
+        } catch (...) {
+            // a strand has no loop to quit
+        }
+        msg.reset();
+        // deferred signals of the strand must not run in another strand,
+        // those that keep deferring wait in the strand behind its messages
+        TEdgeSlotThread::RunDeferred(self.get());
+    }
+
+    TEdgeSlotThread::LocalMailbox = worker_mailbox;
+
+    if (Pending.fetch_sub(done, std::memory_order_acq_rel) == done)
+        return false;
+    SelfRef = std::move(self);
+    return true;
+}
+
+
+TStrandScheduler::TStrandScheduler(size_t threads, ui32 budget)
+    : Budget(budget != 0 ? budget : 1)
+{
+    if (threads == 0)
+        threads = 1;
+    for (size_t i = 0; i < threads; ++i)
+        Workers.emplace_back(new TWorker);
+    for (size_t i = 0; i < threads; ++i)
+        Workers[i]->Thread = std::thread(&TStrandScheduler::WorkerLoop, this, i);
+}
+
+
+bool TStrandScheduler::Submit(TStrand* strand) {
+    if (CurrentScheduler != this)
+        return Inject(strand);
+    Workers[CurrentWorker]->Deque.push(strand);
+    WakeSleeper();
+    return true;
+}
+
+
+bool TStrandScheduler::Inject(TStrand* strand) {
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        if (Stopping.load(std::memory_order_relaxed))
+            return false;
+        Injected.push_back(strand);
+        InjectedSize.fetch_add(1, std::memory_order_relaxed);
+    }
+    WakeSleeper();
+    return true;
+}
+
+
+void TStrandScheduler::WakeSleeper() {
+    // pairs with the fence in WorkerLoop
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (Sleepers.load(std::memory_order_relaxed) == 0)
+        return;
+    std::lock_guard<std::mutex> guard(Lock);
+    Wakeup.notify_one();
+}
+
+
+void TStrandScheduler::Stop() {
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        if (Stopping.exchange(true))
+            return;
+    }
+    Wakeup.notify_all();
+    for (auto& worker: Workers)
+        worker->Thread.join();
+    Drain();
+}
+
+
+void TStrandScheduler::Drain() noexcept {
+    // ready strands will never run, release their self references
+    TStrand* strand;
+    for (auto& worker: Workers) {
+        while (worker->Deque.pop(&strand))
+            strand->SelfRef.reset();
+    }
+    for (auto queued: Injected)
+        queued->SelfRef.reset();
+    Injected.clear();
+    InjectedSize.store(0, std::memory_order_relaxed);
+}
+
+
+bool TStrandScheduler::HasWork() const noexcept {
+    if (InjectedSize.load(std::memory_order_relaxed) != 0)
+        return true;
+    for (auto& worker: Workers) {
+        if (!worker->Deque.empty())
+            return true;
+    }
+    return false;
+}
+
+
+bool TStrandScheduler::FindWork(size_t index, TStrand** strand) {
+    if (Workers[index]->Deque.pop(strand))
+        return true;
+
+    if (InjectedSize.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard<std::mutex> guard(Lock);
+        if (!Injected.empty()) {
+            *strand = Injected.front();
+            Injected.pop_front();
+            InjectedSize.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < Workers.size(); ++i) {
+        auto victim = (index + i) % Workers.size();
+        if (Workers[victim]->Deque.steal(strand))
+            return true;
+    }
+    return false;
+}
+
+
+void TStrandScheduler::WorkerLoop(size_t index) noexcept {
+    CurrentScheduler = this;
+    CurrentWorker = index;
+    auto worker_mailbox = TEdgeSlotThread::LocalMailbox;
+
+    while (!Stopping.load(std::memory_order_acquire)) {
+        TStrand* strand;
+        if (FindWork(index, &strand)) {
+            // a strand that used up its budget goes behind the others
+            if (strand->Run(Budget, worker_mailbox) && !Inject(strand))
+                strand->SelfRef.reset();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(Lock);
+        Sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!Stopping.load(std::memory_order_relaxed) && !HasWork())
+            Wakeup.wait(guard);
+        Sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    CurrentScheduler = nullptr;
+}
+
+
+TEdgeSlotPool::TEdgeSlotPool(const TOptions& options)
+    : Scheduler(std::make_shared<TStrandScheduler>(
+            options.Threads, options.StrandBudget))
+{}
+
+
+} // namespace bsc
@@ -0,0 +1,175 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot.hh"
+#include "ws_deque.hh"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+
+namespace bsc {
+
+
+class TStrand;
+
+
+// Worker threads of a TEdgeSlotPool. A strand that becomes ready is pushed
+// to the deque of the current worker, or to the injection queue if it was
+// scheduled outside of the pool. Idle workers steal from each other.
+class TStrandScheduler {
+public:
+    TStrandScheduler(size_t threads, ui32 budget);
+
+    TStrandScheduler(const TStrandScheduler&) = delete;
+    void operator=(const TStrandScheduler&) = delete;
+
+    // returns false if the pool is stopped
+    bool Submit(TStrand* strand);
+
+    void Stop();
+
+    size_t size() const noexcept {
+        return Workers.size();
+    }
+
+protected:
+    struct TWorker {
+        TWorkStealingDeque<TStrand*> Deque;
+        std::thread Thread;
+    };
+
+    const ui32 Budget;
+    std::vector<std::unique_ptr<TWorker>> Workers;
+
+    std::mutex Lock;
+    std::condition_variable Wakeup;
+    std::deque<TStrand*> Injected;
+    std::atomic<size_t> InjectedSize = {0};
+    std::atomic<ui32> Sleepers = {0};
+    std::atomic<bool> Stopping = {false};
+
+    static thread_local TStrandScheduler* CurrentScheduler;
+    static thread_local size_t CurrentWorker;
+
+    void WorkerLoop(size_t index) noexcept;
+    bool FindWork(size_t index, TStrand** strand);
+    bool HasWork() const noexcept;
+    bool Inject(TStrand* strand);
+    void WakeSleeper();
+    void Drain() noexcept;
+};
+
+
+// A mailbox drained by the workers of a pool, by one worker at a time.
+// While a strand is ready it keeps itself alive by SelfRef, the reference
+// is passed along with the right to run the strand.
+class TStrand: public TMailbox, public std::enable_shared_from_this<TStrand> {
+public:
+    explicit TStrand(std::shared_ptr<TStrandScheduler> scheduler)
+        : TMailbox(TStrandTag())
+        , Scheduler(std::move(scheduler))
+    {}
+
+protected:
+    std::shared_ptr<TStrandScheduler> Scheduler;
+    std::atomic<ui64> Pending = {0};
+    std::shared_ptr<TStrand> SelfRef;
+
+    virtual void Notify() override {
+        if (Pending.fetch_add(1, std::memory_order_acq_rel) != 0)
+            return;
+        SelfRef = shared_from_this();
+        if (!Scheduler->Submit(this))
+            SelfRef.reset();
+    }
+
+    // returns true if the strand is still ready and has to be rescheduled
+    bool Run(ui32 budget, const std::shared_ptr<TMailbox>& worker_mailbox);
+
+    friend class TStrandScheduler;
+};
+
+
+// Runs objects on a fixed number of worker threads. Every object grabbed by
+// the pool gets a strand, a mailbox of its own. Signals to an object are
+// consumed one by one as in a TEdgeSlotThread, but a ready strand runs on
+// any idle worker. Objects that share a strand are called directly by AUTO
+// connections:
+//
+//     auto strand = pool.CreateStrand();
+//     a.GetAnchor().MoveToMailbox(strand);
+//     b.GetAnchor().MoveToMailbox(strand);
+//
+// Objects in strands may not use timers or run nested message loops.
+class TEdgeSlotPool {
+public:
+    struct TOptions {
+        size_t Threads = std::thread::hardware_concurrency();
+        // messages of one strand consumed before other strands get a turn
+        ui32 StrandBudget = 64;
+    };
+
+    TEdgeSlotPool()
+        : TEdgeSlotPool(TOptions())
+    {}
+
+    explicit TEdgeSlotPool(const TOptions& options);
+
+    ~TEdgeSlotPool() {
+        Stop();
+    }
+
+    TEdgeSlotPool(const TEdgeSlotPool&) = delete;
+    void operator=(const TEdgeSlotPool&) = delete;
+
+    std::shared_ptr<TMailbox> CreateStrand() const {
+        return std::make_shared<TStrand>(Scheduler);
+    }
+
+    void GrabObject(TObjectAnchor* anchor) const {
+        anchor->MoveToMailbox(CreateStrand());
+    }
+
+    void GrabObject(TEdgeSlotObject* obj) const {
+        GrabObject(&obj->GetAnchor());
+    }
+
+    size_t size() const noexcept {
+        return Scheduler->size();
+    }
+
+    // Stops and joins the workers, signals to the strands of the pool stay
+    // in their mailboxes. Do not call from a worker.
+    void Stop() {
+        Scheduler->Stop();
+    }
+
+protected:
+    std::shared_ptr<TStrandScheduler> Scheduler;
+};
+
+
+} // namespace bsc
@@ -0,0 +1,405 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "edge_slot.hh"
+#include <exception>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <type_traits>
+
+
+namespace bsc {
+
+
+template <typename TResult>
+class TFuture;
+
+
+// How a result is kept by TReplyState, a void result keeps nothing.
+template <typename TResult>
+struct TReplyValue {
+    using TStored = TResult;
+    using TRef = const TResult&;
+
+    static TRef Ref(const TStored& value) noexcept {
+        return value;
+    }
+
+    template <typename Fn>
+    static TStored Invoke(Fn&& fn) {
+        return fn();
+    }
+};
+
+
+template <>
+struct TReplyValue<void> {
+    struct TStored {};
+    using TRef = void;
+
+    static void Ref(const TStored&) noexcept {
+    }
+
+    template <typename Fn>
+    static TStored Invoke(Fn&& fn) {
+        fn();
+        return TStored();
+    }
+};
+
+
+// The result of a request, shared by the request message and its futures.
+template <typename TResult>
+class TReplyState: public std::enable_shared_from_this<TReplyState<TResult>> {
+public:
+    using TContinuation = std::function<void(TFuture<TResult>)>;
+    using TStored = typename TReplyValue<TResult>::TStored;
+
+    bool IsReady() const noexcept {
+        return Ready.load(std::memory_order_acquire);
+    }
+
+    void SetValue(TStored value) {
+        Complete(std::unique_ptr<TStored>(new TStored(std::move(value))),
+                 std::exception_ptr());
+    }
+
+    // completes a request with a void result
+    void SetValue() {
+        static_assert(std::is_void<TResult>::value, "the result is not void");
+        SetValue(TStored());
+    }
+
+    void SetError(std::exception_ptr error) {
+        Complete(std::unique_ptr<TStored>(), std::move(error));
+    }
+
+    // call when IsReady()
+    typename TReplyValue<TResult>::TRef Get() const {
+        if (Error)
+            std::rethrow_exception(Error);
+        return TReplyValue<TResult>::Ref(*Value);
+    }
+
+    void Then(TMonitorPtr owner, TContinuation continuation) {
+        Subscribe(std::move(owner), nullptr, std::move(continuation));
+    }
+
+    void Then(std::shared_ptr<TMailbox> mailbox, TContinuation continuation) {
+        Subscribe(TMonitorPtr(), std::move(mailbox), std::move(continuation));
+    }
+
+protected:
+    TSpinRWLock Lock;
+    std::atomic<bool> Ready = {false};
+    std::unique_ptr<TStored> Value;
+    std::exception_ptr Error;
+    TMonitorPtr Owner;
+    std::shared_ptr<TMailbox> Mailbox;
+    TContinuation Continuation;
+
+    void Subscribe(TMonitorPtr owner,
+                   std::shared_ptr<TMailbox> mailbox,
+                   TContinuation continuation)
+    {
+        {
+            TWriteGuard guard(&Lock);
+            if (!IsReady()) {
+                Owner = std::move(owner);
+                Mailbox = std::move(mailbox);
+                Continuation = std::move(continuation);
+                return;
+            }
+        }
+        Post(std::move(owner), std::move(mailbox), std::move(continuation));
+    }
+
+    void Complete(std::unique_ptr<TStored> value, std::exception_ptr error) {
+        TMonitorPtr owner;
+        std::shared_ptr<TMailbox> mailbox;
+        TContinuation continuation;
+        {
+            TWriteGuard guard(&Lock);
+            if (IsReady())
+                return;
+            Value = std::move(value);
+            Error = std::move(error);
+            Ready.store(true, std::memory_order_release);
+            owner = std::move(Owner);
+            mailbox = std::move(Mailbox);
+            continuation = std::move(Continuation);
+        }
+        if (continuation)
+            Post(std::move(owner), std::move(mailbox), std::move(continuation));
+    }
+
+    void Post(TMonitorPtr owner,
+              std::shared_ptr<TMailbox> mailbox,
+              TContinuation continuation);
+};
+
+
+// A reply as it comes to the thread that is waiting for it.
+template <typename TResult>
+class TReplyMsg: public TObjectMessage {
+public:
+    using TContinuation = typename TReplyState<TResult>::TContinuation;
+
+    TReplyMsg(TMonitorPtr owner,
+              std::shared_ptr<TReplyState<TResult>> state,
+              TContinuation continuation)
+        : TObjectMessage(std::move(owner))
+        , State(std::move(state))
+        , Continuation(std::move(continuation))
+    {}
+
+    virtual void Consume() override {
+        if (!ObjectLink->IsAlive() || Redirected(this))
+            return;
+        Continuation(TFuture<TResult>(std::move(State)));
+    }
+
+    void Send() {
+        JustSend();
+    }
+
+protected:
+    std::shared_ptr<TReplyState<TResult>> State;
+    TContinuation Continuation;
+};
+
+
+// A reply for a continuation that is bound to a mailbox, not to an object.
+template <typename TResult>
+class TMailboxReplyMsg: public IMessage {
+public:
+    using TContinuation = typename TReplyState<TResult>::TContinuation;
+
+    TMailboxReplyMsg(std::shared_ptr<TReplyState<TResult>> state,
+                     TContinuation continuation)
+        : State(std::move(state))
+        , Continuation(std::move(continuation))
+    {}
+
+    virtual void Consume() override {
+        Continuation(TFuture<TResult>(std::move(State)));
+    }
+
+protected:
+    std::shared_ptr<TReplyState<TResult>> State;
+    TContinuation Continuation;
+};
+
+
+template <typename TResult>
+void TReplyState<TResult>::Post(TMonitorPtr owner,
+                                std::shared_ptr<TMailbox> mailbox,
+                                TContinuation continuation)
+{
+    if (mailbox) {
+        mailbox->enqueue(std::make_shared<TMailboxReplyMsg<TResult>>(
+            this->shared_from_this(), std::move(continuation)));
+        return;
+    }
+    auto msg = new TReplyMsg<TResult>(
+        std::move(owner), this->shared_from_this(), std::move(continuation));
+    msg->Send();
+}
+
+
+// The result of TReplySlot::request(). It does not block, the reply comes
+// to a continuation that is called in the thread of its owner object.
+template <typename TResult>
+class TFuture {
+public:
+    TFuture() = default;
+
+    explicit TFuture(std::shared_ptr<TReplyState<TResult>> state) noexcept
+        : State(std::move(state))
+    {}
+
+    bool valid() const noexcept {
+        return State.get() != nullptr;
+    }
+
+    bool IsReady() const noexcept {
+        return State && State->IsReady();
+    }
+
+    // Returns the result or rethrows the exception of the slot. Throws
+    // std::future_error if the request never reached the slot, and
+    // std::logic_error if the reply has not come yet. Returns nothing for a
+    // void result, it only tells that the slot has finished.
+    typename TReplyValue<TResult>::TRef Get() const {
+        if (!IsReady())
+            throw std::logic_error("the reply has not come yet");
+        return State->Get();
+    }
+
+    // fn(TFuture<TResult>) is called in the thread of owner once the reply
+    // has come, it is not called if the owner has been destroyed
+    template <typename TOwner, typename Fn>
+    void Then(const TOwner* owner, Fn&& fn) {
+        State->Then(owner->GetAnchor().GetLink(), std::forward<Fn>(fn));
+    }
+
+    // fn(TFuture<TResult>) is called by the loop that serves mailbox
+    template <typename Fn>
+    void Then(std::shared_ptr<TMailbox> mailbox, Fn&& fn) {
+        State->Then(std::move(mailbox), std::forward<Fn>(fn));
+    }
+
+protected:
+    std::shared_ptr<TReplyState<TResult>> State;
+};
+
+
+template <typename TResult, typename...TParams>
+class TReplySlot;
+
+
+template <typename TResult, typename...TParams>
+class TRequestMsg: public TObjectMessage {
+public:
+    TRequestMsg(TMonitorPtr link,
+                const TReplySlot<TResult, TParams...>* slot,
+                std::shared_ptr<TReplyState<TResult>> state,
+                TParams...params)
+        : TObjectMessage(std::move(link))
+        , Slot(slot)
+        , State(std::move(state))
+        , Params(std::forward<TParams>(params)...)
+    {}
+
+    // a request dropped on the way breaks the promise
+    ~TRequestMsg() {
+        if (State)
+            State->SetError(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+    }
+
+    virtual void Consume() override {
+        if (!ObjectLink->IsAlive() || Redirected(this))
+            return;
+        Call(std::index_sequence_for<TParams...>());
+    }
+
+protected:
+    const TReplySlot<TResult, TParams...>* Slot;
+    std::shared_ptr<TReplyState<TResult>> State;
+    std::tuple<TParams...> Params;
+
+    template <std::size_t...I>
+    void Call(std::index_sequence<I...>) {
+        auto state = std::move(State);
+        Slot->Reply(state.get(), std::get<I>(std::move(Params))...);
+    }
+};
+
+
+// A slot that returns a value. request() sends the call to the thread of
+// the object and returns at once, see TFuture.
+template <typename TResult, typename...TParams>
+class TReplySlot {
+public:
+    using TCallee = TResult (*)(void*, TParams...);
+
+    template <typename TObject>
+    TReplySlot(TObject* object, TCallee callee)
+        : Object(object)
+        , Link(static_cast<TEdgeSlotObject*>(object)->GetAnchor().GetLink())
+        , Callee(callee)
+    {}
+
+    TReplySlot(const TReplySlot&) = delete;
+    void operator=(const TReplySlot&) = delete;
+
+    TReplySlot(TReplySlot&&) = default;
+
+    // calls the slot directly if its object is in the current thread
+    TFuture<TResult> request(TParams...params) const {
+        auto state = std::make_shared<TReplyState<TResult>>();
+        if (Link->SameMailbox() && !Link->IsFenced()) {
+            Reply(state.get(), std::forward<TParams>(params)...);
+        } else {
+            auto msg = std::make_shared<TRequestMsg<TResult, TParams...>>(
+                Link, this, state, std::forward<TParams>(params)...);
+            msg->SendAs(msg);
+        }
+        return TFuture<TResult>(std::move(state));
+    }
+
+protected:
+    void* Object;
+    TMonitorPtr Link;
+    TCallee Callee;
+
+    friend class TRequestMsg<TResult, TParams...>;
+
+    void Reply(TReplyState<TResult>* state, TParams...params) const {
+        try {
+            state->SetValue(TReplyValue<TResult>::Invoke([&]() {
+                return Callee(Object, std::forward<TParams>(params)...);
+            }));
+        } catch (...) {
+            state->SetError(std::current_exception());
+        }
+    }
+};
+
+
+template <typename TObject, typename TResult, typename...TParams>
+class TReplyCallee {
+public:
+    template <TResult (TObject::* Member)(TParams...)>
+    static TResult Callee(void* object, TParams...params) {
+        return (reinterpret_cast<TObject*>(object)->*Member)(
+            std::forward<TParams>(params)...);
+    }
+
+    using TSlotType = TReplySlot<TResult, TParams...>;
+
+    template <TResult (TObject::* Member)(TParams...)>
+    static TSlotType GetSlot(TObject* object) {
+        return TSlotType(object, &Callee<Member>);
+    }
+};
+
+
+template <typename TObject, typename TResult, typename...TParams>
+TReplyCallee<TObject, TResult, TParams...>
+GetReplyCallee(TResult (TObject::*)(TParams...)) {
+    return TReplyCallee<TObject, TResult, TParams...>{};
+}
+
+
+#define DEFINE_REPLY_SLOT(TObject, Method, SlotName)                          \
+    typename decltype(bsc::GetReplyCallee(&TObject::Method))::TSlotType        \
+        SlotName = decltype(bsc::GetReplyCallee(&TObject::Method))::          \
+            template GetSlot<&TObject::Method>(this)
+
+
+} // namespace bsc
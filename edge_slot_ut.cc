@@ -22,6 +22,15 @@ SOFTWARE.
 */
 
 #include "edge_slot.hh"
+#include "edge_slot_pool.hh"
+#include "edge_slot_balancer.hh"
+#include "edge_slot_group.hh"
+#include "edge_slot_reply.hh"
+#include "edge_slot_coro.hh"
+#include "edge_slot_keyed.hh"
+#include "edge_slot_partition.hh"
+#include <future>
+#include <map>
 #include <thread>
 
 
@@ -41,6 +50,8 @@ using bsc::TMailbox;
 using bsc::TMessagePtr;
 using bsc::TObjectMessage;
 using bsc::TSignal;
+using bsc::TTimerHeap;
+using bsc::TTimerHeapHook;
 
 
 class TTestSlot: public TEdgeSlotObject {
@@ -590,6 +601,22 @@ TEST(EDGE_SLOT, EdgeDisconnectMultipleSlotsWhileEmitting) {
 
 }
 
+TEST(EDGE_SLOT, QueueToSeveralSlots) {
+    TTestEdge sig;
+    TTestSlot first;
+    TTestSlot second;
+    Connect(&sig, &sig.Edge, &first, &first.Slot, bsc::DELIVERY::QUEUE);
+    Connect(&sig, &sig.Edge, &second, &second.Slot, bsc::DELIVERY::QUEUE);
+
+    // every queued connection gets a signal of its own
+    sig.Edge.emit(1, 2);
+    TEdgeSlotThread::MessageLoop(
+        [&]() { return first.Counter + second.Counter < 6; });
+    CHECK(first.Counter == 3);
+    CHECK(second.Counter == 3);
+}
+
+
 TEST(EDGE_SLOT, Message) {
     TTestSlot slt;
     TSignal<int, int> msg(slt.GetAnchor().GetLink(), &slt.Slot, 1, 2);
@@ -781,3 +808,1927 @@ TEST(EDGE_SLOT, NoDeadlockFor_BLOCK_QUEUE_InOneThread) {
     sig.Edge.emit(1, 2);
     CHECK(slt.Counter == 3)
 }
+
+
+class TTestHeapItem: public TTimerHeapHook {
+public:
+    ui64 GetDeadline() const noexcept {
+        return HitTime;
+    }
+
+    ui64 HitTime = 0;
+};
+
+
+TEST(EDGE_SLOT, TimerHeap) {
+    TTestHeapItem items[100];
+    TTimerHeap<TTestHeapItem> heap;
+
+    for (ui32 i = 0; i < 100; ++i) {
+        items[i].HitTime = (i * 37) % 100;
+        heap.push(&items[i]);
+    }
+    CHECK(heap.size() == 100);
+
+    for (ui32 i = 0; i < 100; i += 3)
+        CHECK(heap.erase(&items[i]));
+    CHECK(!heap.erase(&items[0]));
+    CHECK(!items[0].IsQueued());
+
+    items[1].HitTime = 1000;
+    heap.update(&items[1]);
+
+    ui64 prev = 0;
+    ui32 popped = 0;
+    while (!heap.empty()) {
+        auto item = heap.top();
+        CHECK(prev <= item->GetDeadline());
+        prev = item->GetDeadline();
+        heap.pop();
+        CHECK(!item->IsQueued());
+        ++popped;
+    }
+    CHECK(popped == 66);
+    CHECK(prev == 1000);
+}
+
+
+class TTimerOrderSlot: public TEdgeSlotObject {
+public:
+    void first() {
+        Order.push_back(1);
+    }
+
+    void second() {
+        Order.push_back(2);
+        TEdgeSlotThread::PostSelfQuitMessage();
+    }
+
+    DEFINE_SLOT(TTimerOrderSlot, first, FirstSlot);
+    DEFINE_SLOT(TTimerOrderSlot, second, SecondSlot);
+
+    std::vector<int> Order;
+};
+
+
+TEST(EDGE_SLOT, TimersFireInOrder) {
+    TEdgeSlotTimer late(60000);
+    TEdgeSlotTimer early(20000);
+    TEdgeSlotTimer cancelled(10000);
+    TTimerOrderSlot slt;
+
+    Connect(&early, &early.Timeout, &slt, &slt.FirstSlot);
+    Connect(&late, &late.Timeout, &slt, &slt.SecondSlot);
+    Connect(&cancelled, &cancelled.Timeout, &slt, &slt.SecondSlot);
+    late.Activate();
+    early.Activate();
+    cancelled.Activate();
+    cancelled.Deactivate();
+
+    TEdgeSlotThread::MessageLoop();
+
+    CHECK(slt.Order.size() == 2);
+    CHECK(slt.Order[0] == 1);
+    CHECK(slt.Order[1] == 2);
+}
+
+
+TEST(EDGE_SLOT, TimerFdBackend) {
+    TEdgeSlotThread::LocalMailbox =
+        std::make_shared<TMailbox>(bsc::MAILBOX_WAKEUP::EVENTFD);
+    TEdgeSlotThread::SetTimerBackend(bsc::TIMER_BACKEND::TIMERFD);
+    TEdgeSlotThread::ResetTimerStats();
+
+    TEdgeSlotTimer timer(20000);
+    TTriggerPostQuitMessage slt;
+
+    Connect(&timer, &timer.Timeout, &slt, &slt.Slot);
+    timer.Activate();
+
+    TEdgeSlotThread::MessageLoop();
+
+    const auto& stats = TEdgeSlotThread::GetTimerStats();
+    CHECK(stats.Hits == 1);
+    CHECK(stats.MaxLateness == stats.TotalLateness);
+    CHECK(stats.MaxLateness < 1000000);
+}
+
+
+TEST(EDGE_SLOT_THREAD, TimerFdThreadReceivesSignals) {
+    TEdgeSlotThread::TOptions options;
+    options.TimerBackend = bsc::TIMER_BACKEND::TIMERFD;
+    TEdgeSlotThread thr(options);
+
+    TCheckMailboxTestSlot slt;
+    thr.GrabObject(&slt);
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 3);
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+class TAdvanceClockMessage: public IMessage {
+public:
+    TAdvanceClockMessage(bsc::TVirtualClock* clock, ui64 delta)
+        : Clock(clock)
+        , Delta(delta)
+    {}
+
+    virtual void Consume() override {
+        Clock->Advance(Delta);
+    }
+
+protected:
+    bsc::TVirtualClock* Clock;
+    ui64 Delta;
+};
+
+
+TEST(EDGE_SLOT, VirtualClock) {
+    auto clock = std::make_shared<bsc::TVirtualClock>(5000000);
+    TEdgeSlotThread::SetClockSource(clock);
+    TEdgeSlotThread::ResetTimerStats();
+
+    {
+        TEdgeSlotTimer timer(3600000000);
+        TTriggerPostQuitMessage slt;
+
+        Connect(&timer, &timer.Timeout, &slt, &slt.Slot);
+        timer.Activate();
+        CHECK(timer.GetNextHitTime() == 3605000000);
+
+        TEdgeSlotThread::LocalMailbox->enqueue(
+            TMessagePtr(new TAdvanceClockMessage(clock.get(), 3600000000)));
+        TEdgeSlotThread::MessageLoop();
+
+        CHECK(TEdgeSlotThread::GetCachedNow() == 3605000000);
+        CHECK(TEdgeSlotThread::GetTimerStats().Hits == 1);
+        CHECK(TEdgeSlotThread::GetTimerStats().MaxLateness == 0);
+    }
+
+    TEdgeSlotThread::SetClockSource(nullptr);
+}
+
+
+TEST(EDGE_SLOT, TscClock) {
+    bsc::TTscClock clock(1000);
+
+    ui64 prev = clock.GetNow();
+    for (ui32 i = 0; i < 10000; ++i) {
+        ui64 now = clock.GetNow();
+        CHECK(prev <= now);
+        prev = now;
+    }
+
+    ui64 mono = bsc::TMonotonicClock::Now();
+    ui64 tsc = clock.GetNow();
+    ui64 diff = mono > tsc ? mono - tsc : tsc - mono;
+    CHECK(diff < 10000);
+}
+
+
+class THitCounter: public TEdgeSlotObject {
+public:
+    void hit() {
+        if (++Hits == QuitAfter)
+            TEdgeSlotThread::PostSelfQuitMessage();
+    }
+
+    DEFINE_SLOT(THitCounter, hit, Slot);
+
+    ui32 Hits = 0;
+    ui32 QuitAfter = 0;
+};
+
+
+TEST(EDGE_SLOT, TimerSlackCoalescesWakeups) {
+    TEdgeSlotThread::ResetTimerStats();
+
+    TEdgeSlotTimer timers[3] = {{10000}, {12000}, {14000}};
+    THitCounter counter;
+    counter.QuitAfter = 3;
+
+    for (auto& timer: timers) {
+        Connect(&timer, &timer.Timeout, &counter, &counter.Slot);
+        timer.SetSlack(20000);
+        timer.Activate();
+    }
+
+    TEdgeSlotThread::MessageLoop();
+
+    const auto& stats = TEdgeSlotThread::GetTimerStats();
+    CHECK(counter.Hits == 3);
+    CHECK(stats.Hits == 3);
+    CHECK(stats.Wakeups == 1);
+    CHECK(stats.WakeupsSaved == 2);
+}
+
+
+TEST(EDGE_SLOT, TimerDriftPolicy) {
+    auto clock = std::make_shared<bsc::TVirtualClock>(0);
+    TEdgeSlotThread::SetClockSource(clock);
+    TEdgeSlotThread::ResetTimerStats();
+
+    {
+        TEdgeSlotTimer catch_up(10, true);
+        TEdgeSlotTimer skip(10, true);
+        skip.SetDriftPolicy(bsc::TIMER_DRIFT::SKIP);
+        catch_up.Activate();
+        skip.Activate();
+
+        clock->Set(35);
+        TEdgeSlotThread::RefreshNow();
+        catch_up.Reregister();
+        skip.Reregister();
+
+        CHECK(catch_up.GetNextHitTime() == 20);
+        CHECK(skip.GetNextHitTime() == 40);
+        CHECK(TEdgeSlotThread::GetTimerStats().SkippedPeriods == 2);
+
+        catch_up.Deactivate();
+        skip.Deactivate();
+    }
+
+    TEdgeSlotThread::SetClockSource(nullptr);
+}
+
+
+TEST(EDGE_SLOT, CallbackTimers) {
+    TTimerOrderSlot slt;
+
+    auto first = TEdgeSlotThread::ScheduleAfter(10000, &slt, &slt.FirstSlot);
+    auto second = TEdgeSlotThread::ScheduleAfter(20000, &slt, &slt.SecondSlot);
+    auto cancelled = TEdgeSlotThread::ScheduleAfter(5000, &slt, &slt.SecondSlot);
+    CHECK(TEdgeSlotThread::CancelTimer(cancelled));
+    CHECK(!TEdgeSlotThread::CancelTimer(cancelled));
+
+    auto dead = std::make_unique<THitCounter>();
+    TEdgeSlotThread::ScheduleAfter(1000, dead.get(), &dead->Slot);
+    dead.reset();
+
+    TEdgeSlotThread::MessageLoop();
+
+    CHECK(slt.Order.size() == 2);
+    CHECK(slt.Order[0] == 1);
+    CHECK(slt.Order[1] == 2);
+    CHECK(!TEdgeSlotThread::CancelTimer(first));
+    CHECK(!TEdgeSlotThread::CancelTimer(second));
+}
+
+
+class TRecordMessage: public IMessage {
+public:
+    TRecordMessage(std::vector<int>* order, int value)
+        : Order(order)
+        , Value(value)
+    {}
+
+    virtual void Consume() override {
+        Order->push_back(Value);
+    }
+
+protected:
+    std::vector<int>* Order;
+    int Value;
+};
+
+
+class TSlowTimerSlot: public TEdgeSlotObject {
+public:
+    void hit() {
+        Clock->Advance(10);
+        Order->push_back(1);
+    }
+
+    DEFINE_SLOT(TSlowTimerSlot, hit, Slot);
+
+    bsc::TVirtualClock* Clock = nullptr;
+    std::vector<int>* Order = nullptr;
+};
+
+
+TEST(EDGE_SLOT, LoopMessageBudget) {
+    std::vector<int> order;
+    bsc::TLoopPolicy policy;
+    policy.MessageBudget = 2;
+    TEdgeSlotThread::SetLoopPolicy(policy);
+    TEdgeSlotThread::ResetLoopStats();
+
+    for (int i = 0; i < 5; ++i) {
+        TEdgeSlotThread::LocalMailbox->enqueue(
+            TMessagePtr(new TRecordMessage(&order, i)));
+    }
+    TEdgeSlotThread::MessageLoop([&]() { return order.size() < 5; });
+
+    const auto& stats = TEdgeSlotThread::GetLoopStats();
+    CHECK(stats.Messages == 5);
+    CHECK(stats.Iterations == 3);
+    CHECK(stats.BudgetsExhausted == 2);
+
+    TEdgeSlotThread::SetLoopPolicy(bsc::TLoopPolicy());
+}
+
+
+TEST(EDGE_SLOT, LoopTimerSlice) {
+    auto clock = std::make_shared<bsc::TVirtualClock>(0);
+    TEdgeSlotThread::SetClockSource(clock);
+    bsc::TLoopPolicy policy;
+    policy.TimerSlice = 15;
+    TEdgeSlotThread::SetLoopPolicy(policy);
+    TEdgeSlotThread::ResetLoopStats();
+
+    std::vector<int> order;
+    TSlowTimerSlot slt;
+    slt.Clock = clock.get();
+    slt.Order = &order;
+    for (int i = 0; i < 5; ++i)
+        TEdgeSlotThread::ScheduleAt(10, slt.GetAnchor().GetLink(), &slt.Slot);
+
+    clock->Set(100);
+    TEdgeSlotThread::LocalMailbox->enqueue(
+        TMessagePtr(new TRecordMessage(&order, 2)));
+    TEdgeSlotThread::MessageLoop([&]() { return order.size() < 6; });
+
+    // the message is consumed between two slices of expired timers
+    CHECK(order.size() == 6);
+    CHECK(order[2] == 2);
+    const auto& stats = TEdgeSlotThread::GetLoopStats();
+    CHECK(stats.SlicesExhausted == 2);
+    CHECK(stats.MaxTimerBacklog == 130);
+
+    TEdgeSlotThread::SetLoopPolicy(bsc::TLoopPolicy());
+    TEdgeSlotThread::SetClockSource(nullptr);
+}
+
+
+class TDeferredCountdown: public TEdgeSlotObject {
+public:
+    void count(int left, int) {
+        Order->push_back(left);
+        if (MaxDepth < Nested)
+            MaxDepth = Nested;
+        if (left == 0)
+            return;
+        ++Nested;
+        Edge.emit(left - 1, 0);
+        --Nested;
+    }
+
+    DEFINE_SLOT(TDeferredCountdown, count, Slot);
+
+    TEdge<int, int> Edge = TEdge<int, int>(this);
+    std::vector<int>* Order = nullptr;
+    int Nested = 0;
+    int MaxDepth = 0;
+};
+
+
+TEST(EDGE_SLOT, DeferredDelivery) {
+    std::vector<int> order;
+    TDeferredCountdown cnt;
+    cnt.Order = &order;
+    Connect(&cnt, &cnt.Edge, &cnt, &cnt.Slot, bsc::DELIVERY::DEFERRED);
+
+    auto mailbox = TEdgeSlotThread::LocalMailbox;
+    auto enqueued = mailbox->GetDequeued() + mailbox->GetDepth();
+    mailbox->enqueue(TMessagePtr(new TRecordMessage(&order, -1)));
+    cnt.Edge.emit(100, 0);
+    CHECK(order.empty());
+
+    TEdgeSlotThread::MessageLoop([&]() { return order.size() < 102; });
+
+    // deferred signals come before the mailbox and do not nest, the
+    // mailbox gets a turn after the first run of them
+    CHECK(order.size() == 102);
+    CHECK(order[0] == 100);
+    CHECK(order[1] == -1);
+    for (int i = 2; i <= 101; ++i)
+        CHECK(order[i] == 101 - i);
+    CHECK(cnt.MaxDepth == 0);
+    CHECK(mailbox->GetDequeued() + mailbox->GetDepth() == enqueued + 1);
+}
+
+
+TEST(EDGE_SLOT, DeferredLoopLetsQuitThrough) {
+    std::vector<int> order;
+    TDeferredCountdown cnt;
+    cnt.Order = &order;
+    Connect(&cnt, &cnt.Edge, &cnt, &cnt.Slot, bsc::DELIVERY::DEFERRED);
+
+    // the countdown would keep the loop busy for a long time
+    cnt.Edge.emit(1000000, 0);
+    TEdgeSlotThread::PostSelfQuitMessage();
+    CHECK(TEdgeSlotThread::MessageLoop([]() { return true; }));
+    CHECK(order.size() < 10);
+
+    // a removed connection drops the rest of the countdown
+    Disconnect(&cnt, &cnt.Edge, &cnt, &cnt.Slot);
+    TEdgeSlotThread::RunDeferred(TEdgeSlotThread::LocalMailbox.get());
+    CHECK(order.size() < 10);
+}
+
+
+TEST(EDGE_SLOT, BusyPollTimers) {
+    bsc::TLoopPolicy policy;
+    policy.BusyPollYield = 100;
+    TEdgeSlotThread::SetLoopPolicy(policy);
+    TEdgeSlotThread::ResetLoopStats();
+    TEdgeSlotThread::LocalMailbox->SetBusyPoll(true);
+
+    TTriggerPostQuitMessage trigger;
+    auto start = TEdgeSlotThread::GetNow();
+    TEdgeSlotThread::ScheduleAfter(20000, &trigger, &trigger.Slot);
+    TEdgeSlotThread::MessageLoop();
+
+    CHECK(TEdgeSlotThread::GetNow() - start >= 20000);
+    CHECK(TEdgeSlotThread::GetLoopStats().BusyPollYields != 0);
+
+    TEdgeSlotThread::LocalMailbox->SetBusyPoll(false);
+    TEdgeSlotThread::SetLoopPolicy(bsc::TLoopPolicy());
+    TEdgeSlotThread::ResetLoopStats();
+}
+
+
+TEST(EDGE_SLOT, CpuTopology) {
+    auto cpus = bsc::TCpuTopology::ParseCpuList("0-2,5,8-9\n");
+    CHECK(cpus == std::vector<int>({0, 1, 2, 5, 8, 9}));
+    CHECK(bsc::TCpuTopology::ParseCpuList("").empty());
+
+    CHECK(bsc::TCpuTopology::GetNodeCount() >= 1);
+    CHECK(bsc::TCpuTopology::GetCpuCount() >= 1);
+    CHECK(!bsc::TCpuTopology::GetAllowedCpus().empty());
+}
+
+
+class TCpuRecorder: public TEdgeSlotObject {
+public:
+    void record() {
+        Cpu = bsc::TCpuTopology::GetCurrentCpu();
+        Allowed = bsc::TCpuTopology::GetAllowedCpus();
+    }
+
+    DEFINE_SLOT(TCpuRecorder, record, Slot);
+
+    int Cpu = -1;
+    std::vector<int> Allowed;
+};
+
+
+class TVoidEdge: public TEdgeSlotObject {
+public:
+    TEdge<> Edge = TEdge<>(this);
+};
+
+
+TEST(EDGE_SLOT_THREAD, PinnedThread) {
+    auto cpu = bsc::TCpuTopology::GetAllowedCpus().back();
+    TEdgeSlotThread::TOptions options;
+    options.Cpus = {cpu};
+    TEdgeSlotThread thr(options);
+    CHECK(thr.GetNumaNode() == bsc::TCpuTopology::GetCpuNode(cpu));
+
+    TCpuRecorder rec;
+    TVoidEdge sig;
+    thr.GrabObject(&rec);
+    Connect(&sig, &sig.Edge, &rec, &rec.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    sig.Edge.emit();
+
+    thr.PostQuitMessage();
+    thr.join();
+
+    CHECK(rec.Cpu == cpu);
+    CHECK(rec.Allowed == std::vector<int>({cpu}));
+}
+
+
+TEST(EDGE_SLOT_THREAD, PinningFailure) {
+    TEdgeSlotThread::TOptions options;
+    options.Cpus = {-1};
+    bool thrown = false;
+    try {
+        TEdgeSlotThread thr(options);
+    } catch (bsc::ESyscallError&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+
+TEST(EDGE_SLOT, WorkStealingDeque) {
+    bsc::TWorkStealingDeque<int> deque(2);
+    int item;
+    CHECK(!deque.pop(&item));
+    CHECK(!deque.steal(&item));
+
+    for (int i = 0; i < 10; ++i)
+        deque.push(i);
+    CHECK(deque.steal(&item));
+    CHECK(item == 0);
+    CHECK(deque.pop(&item));
+    CHECK(item == 9);
+
+    int count = 0;
+    while (deque.pop(&item))
+        ++count;
+    CHECK(count == 8);
+    CHECK(deque.empty());
+}
+
+
+TEST(EDGE_SLOT_THREAD, WorkStealingDequeThieves) {
+    constexpr int items = 100000;
+    bsc::TWorkStealingDeque<int> deque;
+    std::vector<std::atomic<int>> seen(items);
+    std::atomic<bool> done = {false};
+
+    auto thief = [&]() {
+        int item;
+        while (!done.load()) {
+            if (deque.steal(&item))
+                ++seen[item];
+        }
+        while (deque.steal(&item))
+            ++seen[item];
+    };
+    std::thread thieves[3] = {
+        std::thread(thief), std::thread(thief), std::thread(thief)};
+
+    int item;
+    for (int i = 0; i < items; ++i) {
+        deque.push(i);
+        if (i % 3 == 0 && deque.pop(&item))
+            ++seen[item];
+    }
+    while (deque.pop(&item))
+        ++seen[item];
+    done = true;
+    for (auto& thr: thieves)
+        thr.join();
+
+    for (auto& count: seen)
+        CHECK(count.load() == 1);
+}
+
+
+class TStrandSlot: public TEdgeSlotObject {
+public:
+    void add(int a, int b) {
+        CHECK(!Inside.exchange(true));
+        Counter += a + b;
+        Inside = false;
+    }
+
+    DEFINE_SLOT(TStrandSlot, add, Slot);
+
+    std::atomic<bool> Inside = {false};
+    int Counter = 0;
+};
+
+
+TEST(EDGE_SLOT_THREAD, PoolStrands) {
+    bsc::TEdgeSlotPool::TOptions options;
+    options.Threads = 4;
+    options.StrandBudget = 4;
+    bsc::TEdgeSlotPool pool(options);
+    CHECK(pool.size() == 4);
+
+    constexpr int objects = 50;
+    std::vector<std::unique_ptr<TStrandSlot>> slots;
+    TTestEdge sig;
+    TTestEdge barrier;
+    for (int i = 0; i < objects; ++i) {
+        slots.emplace_back(new TStrandSlot);
+        pool.GrabObject(slots.back().get());
+        Connect(&sig, &sig.Edge, slots.back().get(), &slots.back()->Slot);
+        Connect(&barrier, &barrier.Edge, slots.back().get(),
+                &slots.back()->Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    }
+
+    for (int i = 0; i < 100; ++i)
+        sig.Edge.emit(1, 2);
+    // the blocking signal is consumed after all queued ones
+    barrier.Edge.emit(0, 0);
+
+    for (auto& slt: slots)
+        CHECK(slt->Counter == 300);
+
+    pool.Stop();
+    sig.Edge.emit(1, 2);
+    for (auto& slt: slots)
+        CHECK(slt->Counter == 300);
+}
+
+
+class TDeferredForward: public TEdgeSlotObject {
+public:
+    void forward(int a, int b) {
+        Edge.emit(a, b);
+    }
+
+    DEFINE_SLOT(TDeferredForward, forward, Slot);
+
+    TEdge<int, int> Edge = TEdge<int, int>(this);
+};
+
+
+TEST(EDGE_SLOT_THREAD, PoolDeferredStaysInStrand) {
+    bsc::TEdgeSlotPool pool;
+    auto strand = pool.CreateStrand();
+    TStrandSlot slt;
+    TDeferredForward fwd;
+    slt.GetAnchor().MoveToMailbox(strand);
+    fwd.GetAnchor().MoveToMailbox(strand);
+    Connect(&fwd, &fwd.Edge, &slt, &slt.Slot, bsc::DELIVERY::DEFERRED);
+
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&sig, &sig.Edge, &fwd, &fwd.Slot);
+    Connect(&barrier, &barrier.Edge, &slt, &slt.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+
+    for (int i = 0; i < 100; ++i)
+        sig.Edge.emit(1, 2);
+    // deferred signals run before the next message of the strand
+    barrier.Edge.emit(0, 0);
+    CHECK(slt.Counter == 300);
+    pool.Stop();
+}
+
+
+TEST(EDGE_SLOT_THREAD, PoolDeferredLoopLetsStrandThrough) {
+    bsc::TEdgeSlotPool pool;
+    auto strand = pool.CreateStrand();
+    std::vector<int> order;
+    TDeferredCountdown cnt;
+    TStrandSlot slt;
+    cnt.Order = &order;
+    cnt.GetAnchor().MoveToMailbox(strand);
+    slt.GetAnchor().MoveToMailbox(strand);
+    Connect(&cnt, &cnt.Edge, &cnt, &cnt.Slot, bsc::DELIVERY::DEFERRED);
+
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&sig, &sig.Edge, &cnt, &cnt.Slot);
+    Connect(&barrier, &barrier.Edge, &slt, &slt.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+
+    // the countdown would keep the strand busy for a long time
+    sig.Edge.emit(1000000, 0);
+    Disconnect(&cnt, &cnt.Edge, &cnt, &cnt.Slot);
+    barrier.Edge.emit(0, 0);
+    CHECK(order.back() != 0);
+    pool.Stop();
+}
+
+
+class TStrandMailboxCheck: public TEdgeSlotObject {
+public:
+    void check(int a, int b) {
+        Same = TEdgeSlotThread::LocalMailbox == Strand;
+        Checked = true;
+        Edge.Edge.emit(a, b);
+    }
+
+    DEFINE_SLOT(TStrandMailboxCheck, check, Slot);
+
+    TTestEdge Edge;
+    std::shared_ptr<TMailbox> Strand;
+    bool Same = false;
+    bool Checked = false;
+};
+
+
+TEST(EDGE_SLOT_THREAD, PoolSharedStrandCallsDirectly) {
+    bsc::TEdgeSlotPool pool;
+    auto strand = pool.CreateStrand();
+
+    TStrandMailboxCheck first;
+    TStrandMailboxCheck second;
+    first.Strand = second.Strand = strand;
+    first.GetAnchor().MoveToMailbox(strand);
+    second.GetAnchor().MoveToMailbox(strand);
+    first.Edge.GetAnchor().MoveToMailbox(strand);
+    Connect(&first.Edge, &first.Edge.Edge, &second, &second.Slot);
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &first, &first.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    sig.Edge.emit(1, 2);
+    CHECK(first.Same);
+    // called directly while the blocking signal was consumed
+    CHECK(second.Checked);
+    CHECK(second.Same);
+}
+
+
+TEST(EDGE_SLOT, AffinitySample) {
+    TMailbox first;
+    TMailbox second;
+    bsc::TAffinitySample sample;
+
+    for (int i = 0; i < 30; ++i) {
+        sample.Record(&first);
+        sample.Record(&first);
+        sample.Record(&first);
+        sample.Record(&second);
+    }
+    auto snapshot = sample.Take();
+    CHECK(snapshot.Signals == 120);
+    CHECK(snapshot.Candidate == &first);
+    CHECK(snapshot.Lead == 60);
+    CHECK(sample.Take().Signals == 0);
+}
+
+
+class TThreadRecorder: public TEdgeSlotObject {
+public:
+    void add(int a, int b) {
+        Thread = std::this_thread::get_id();
+        Counter += a + b;
+    }
+
+    DEFINE_SLOT(TThreadRecorder, add, Slot);
+
+    std::thread::id Thread;
+    int Counter = 0;
+};
+
+
+TEST(EDGE_SLOT_THREAD, SignalFollowsMovedObject) {
+    TEdgeSlotThread thr;
+    TThreadRecorder rec;
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&sig, &sig.Edge, &rec, &rec.Slot, bsc::DELIVERY::QUEUE);
+    Connect(&barrier, &barrier.Edge, &rec, &rec.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+
+    // the signal waits in the mailbox of this thread
+    sig.Edge.emit(1, 2);
+    thr.GrabObject(&rec);
+    TEdgeSlotThread::PostSelfQuitMessage();
+    TEdgeSlotThread::MessageLoop();
+    barrier.Edge.emit(0, 0);
+
+    CHECK(rec.Counter == 3);
+    CHECK(rec.Thread == thr.get_id());
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+static void WaitForMailbox(TEdgeSlotObject* object, const TMailbox* mailbox) {
+    while (object->GetAnchor().GetLink()->GetMailbox().get() != mailbox)
+        std::this_thread::yield();
+}
+
+
+TEST(EDGE_SLOT_THREAD, BalancerMovesObjectToSender) {
+    TEdgeSlotThread thr;
+    TThreadRecorder rec;
+    thr.GrabObject(&rec);
+
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&sig, &sig.Edge, &rec, &rec.Slot);
+    Connect(&barrier, &barrier.Edge, &rec, &rec.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+
+    bsc::TEdgeSlotBalancer::TOptions options;
+    options.Rounds = 2;
+    bsc::TEdgeSlotBalancer balancer(options);
+    balancer.AddThread(&thr);
+    balancer.AddMailbox(TEdgeSlotThread::LocalMailbox);
+    balancer.Watch(&rec);
+
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 200; ++i)
+            sig.Edge.emit(1, 2);
+        barrier.Edge.emit(0, 0);
+        balancer.Balance();
+    }
+    CHECK(balancer.GetStats().AffinityMoves == 1);
+    WaitForMailbox(&rec, TEdgeSlotThread::LocalMailbox.get());
+    // wait for the fence marker that comes through the previous thread
+    auto link = rec.GetAnchor().GetLink();
+    TEdgeSlotThread::MessageLoop([&]() { return link->IsFenced(); });
+    CHECK(rec.Counter == 1200);
+
+    // the object is local now, AUTO connections call it directly
+    sig.Edge.emit(1, 2);
+    CHECK(rec.Counter == 1203);
+    CHECK(rec.Thread == std::this_thread::get_id());
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+class TBlockingMessage: public IMessage {
+public:
+    explicit TBlockingMessage(std::shared_future<void> release)
+        : Release(std::move(release))
+    {}
+
+    virtual void Consume() override {
+        Release.wait();
+    }
+
+protected:
+    std::shared_future<void> Release;
+};
+
+
+TEST(EDGE_SLOT_THREAD, BalancerMovesObjectFromOverloadedThread) {
+    TEdgeSlotThread busy;
+    TEdgeSlotThread idle;
+    TThreadRecorder rec;
+    busy.GrabObject(&rec);
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &rec, &rec.Slot);
+
+    std::promise<void> release;
+    busy.GetMailbox()->enqueue(
+        TMessagePtr(new TBlockingMessage(release.get_future().share())));
+    for (int i = 0; i < 20; ++i)
+        sig.Edge.emit(1, 2);
+
+    bsc::TEdgeSlotBalancer::TOptions options;
+    options.OverloadDepth = 10;
+    bsc::TEdgeSlotBalancer balancer(options);
+    balancer.AddThread(&busy);
+    balancer.AddThread(&idle);
+    balancer.Watch(&rec);
+    balancer.Balance();
+    CHECK(balancer.GetStats().LoadMoves == 1);
+
+    release.set_value();
+    WaitForMailbox(&rec, idle.GetMailbox().get());
+
+    TTestEdge barrier;
+    Connect(&barrier, &barrier.Edge, &rec, &rec.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+    CHECK(rec.Counter == 60);
+    CHECK(rec.Thread == idle.get_id());
+
+    busy.PostQuitMessage();
+    idle.PostQuitMessage();
+    busy.join();
+    idle.join();
+}
+
+
+class TSequenceSlot: public TEdgeSlotObject {
+public:
+    void next(int seq, int) {
+        if (seq < 0)
+            return;
+        if (seq != Last + 1)
+            ++Violations;
+        Last = seq;
+        ++Count;
+        // a slow consumer lets signals pile up in the mailbox
+        for (volatile int i = 0; i < 1000;)
+            i = i + 1;
+    }
+
+    DEFINE_SLOT(TSequenceSlot, next, Slot);
+
+    int Last = 0;
+    int Count = 0;
+    int Violations = 0;
+};
+
+
+TEST(EDGE_SLOT_THREAD, MigrationKeepsOrder) {
+    constexpr int signals = 20000;
+    TEdgeSlotThread first;
+    TEdgeSlotThread second;
+    TSequenceSlot seq;
+    first.GrabObject(&seq);
+
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&sig, &sig.Edge, &seq, &seq.Slot);
+    Connect(&barrier, &barrier.Edge, &seq, &seq.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+
+    std::atomic<bool> done = {false};
+    std::thread producer([&]() {
+        for (int i = 1; i <= signals; ++i)
+            sig.Edge.emit(i, 0);
+        done = true;
+    });
+
+    for (int i = 0; !done; ++i) {
+        auto target = i % 2 == 0 ? &second : &first;
+        seq.GetAnchor().MigrateToThread(target);
+        WaitForMailbox(&seq, target->GetMailbox().get());
+    }
+
+    producer.join();
+    barrier.Edge.emit(-1, 0);
+
+    CHECK(seq.Count == signals);
+    CHECK(seq.Violations == 0);
+
+    first.PostQuitMessage();
+    second.PostQuitMessage();
+    first.join();
+    second.join();
+}
+
+
+class TGatedRecorder: public TThreadRecorder {
+public:
+    void wait(int, int) {
+        Release.wait();
+    }
+
+    DEFINE_SLOT(TGatedRecorder, wait, WaitSlot);
+
+    std::shared_future<void> Release;
+};
+
+
+static void WaitForSettled(TEdgeSlotObject* first, TEdgeSlotObject* second,
+                           bool apart) {
+    auto first_link = first->GetAnchor().GetLink();
+    auto second_link = second->GetAnchor().GetLink();
+    while (first_link->IsFenced() || second_link->IsFenced() ||
+           (first_link->GetMailbox() != second_link->GetMailbox()) != apart)
+        std::this_thread::yield();
+}
+
+
+TEST(EDGE_SLOT_THREAD, ThreadGroupGrowsAndShrinks) {
+    bsc::TEdgeSlotThreadGroup::TOptions options;
+    options.MinThreads = 1;
+    options.MaxThreads = 2;
+    options.Period = 0;
+    options.GrowDepth = 10;
+    options.GrowLatency = 0;
+    options.IdleDepth = 0;
+    options.IdleRounds = 2;
+    bsc::TEdgeSlotThreadGroup group(options);
+
+    TGatedRecorder first;
+    TThreadRecorder second;
+    group.GrabObject(&first);
+    group.GrabObject(&second);
+    CHECK(group.size() == 1);
+
+    TTestEdge gate;
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&gate, &gate.Edge, &first, &first.WaitSlot);
+    Connect(&sig, &sig.Edge, &second, &second.Slot);
+    Connect(&barrier, &barrier.Edge, &first, &first.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    Connect(&barrier, &barrier.Edge, &second, &second.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+
+    // the only thread is stuck, signals pile up in its mailbox
+    std::promise<void> release;
+    first.Release = release.get_future().share();
+    gate.Edge.emit(0, 0);
+    for (int i = 0; i < 20; ++i)
+        sig.Edge.emit(1, 2);
+
+    group.Adjust();
+    CHECK(group.size() == 2);
+    CHECK(group.GetStats().Spawned == 2);
+    CHECK(group.GetStats().Migrations == 1);
+
+    release.set_value();
+    WaitForSettled(&first, &second, true);
+    barrier.Edge.emit(0, 0);
+    CHECK(second.Counter == 60);
+    CHECK(first.Thread != second.Thread);
+
+    // idle rounds retire a thread, its objects move to the other one
+    for (int i = 0; i < 10000 && group.GetStats().Retired == 0; ++i) {
+        group.Adjust();
+        std::this_thread::yield();
+    }
+    CHECK(group.GetStats().Retired == 1);
+    CHECK(group.size() == 1);
+
+    WaitForSettled(&first, &second, false);
+    barrier.Edge.emit(0, 0);
+    CHECK(first.Thread == second.Thread);
+}
+
+
+TEST(EDGE_SLOT_THREAD, ThreadGroupSpawnTakesFairShare) {
+    bsc::TEdgeSlotThreadGroup::TOptions options;
+    options.MinThreads = 1;
+    options.MaxThreads = 2;
+    options.Period = 0;
+    options.GrowDepth = 10;
+    options.GrowLatency = 0;
+    bsc::TEdgeSlotThreadGroup group(options);
+
+    TGatedRecorder gated;
+    TThreadRecorder recorders[3];
+    group.GrabObject(&gated);
+    for (auto& rec: recorders)
+        group.GrabObject(&rec);
+
+    TTestEdge gate;
+    TTestEdge sig;
+    TTestEdge barrier;
+    Connect(&gate, &gate.Edge, &gated, &gated.WaitSlot);
+    Connect(&barrier, &barrier.Edge, &gated, &gated.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    for (auto& rec: recorders) {
+        Connect(&sig, &sig.Edge, &rec, &rec.Slot);
+        Connect(&barrier, &barrier.Edge, &rec, &rec.Slot,
+                bsc::DELIVERY::BLOCK_QUEUE);
+    }
+
+    std::promise<void> release;
+    gated.Release = release.get_future().share();
+    gate.Edge.emit(0, 0);
+    for (int i = 0; i < 20; ++i)
+        sig.Edge.emit(1, 2);
+
+    // two distinct objects move to the new thread
+    group.Adjust();
+    CHECK(group.size() == 2);
+    CHECK(group.GetStats().Migrations == 2);
+
+    release.set_value();
+    barrier.Edge.emit(0, 0);
+    std::map<std::thread::id, int> placement;
+    ++placement[gated.Thread];
+    for (auto& rec: recorders)
+        ++placement[rec.Thread];
+    CHECK(placement.size() == 2);
+    for (const auto& thread: placement)
+        CHECK(thread.second == 2);
+}
+
+
+TEST(EDGE_SLOT_THREAD, ThreadGroupLatencyNeedsOldBacklog) {
+    bsc::TEdgeSlotThreadGroup::TOptions options;
+    options.MinThreads = 1;
+    options.MaxThreads = 2;
+    options.Period = 0;
+    options.GrowDepth = 1000;
+    options.GrowLatency = 1000;
+    bsc::TEdgeSlotThreadGroup group(options);
+
+    TGatedRecorder gated;
+    group.GrabObject(&gated);
+    TTestEdge gate;
+    TTestEdge sig;
+    Connect(&gate, &gate.Edge, &gated, &gated.WaitSlot);
+    Connect(&sig, &sig.Edge, &gated, &gated.Slot);
+
+    std::promise<void> release;
+    gated.Release = release.get_future().share();
+    auto mailbox = gated.GetAnchor().GetLink()->GetMailbox();
+    gate.Edge.emit(0, 0);
+    while (mailbox->GetDepth() != 0)
+        std::this_thread::yield();
+    group.Adjust();
+
+    // a signal that has just come is no stall
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    sig.Edge.emit(1, 2);
+    group.Adjust();
+    CHECK(group.size() == 1);
+    CHECK(group.GetStats().MaxLatency == 0);
+
+    // but it is once it waits a whole period
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    group.Adjust();
+    CHECK(group.size() == 2);
+    CHECK(group.GetStats().MaxLatency >= 5000);
+
+    release.set_value();
+}
+
+
+TEST(EDGE_SLOT_THREAD, BusyPollToggle) {
+    TEdgeSlotThread::TOptions options;
+    options.BusyPoll = true;
+    options.LoopPolicy.BusyPollYield = 100;
+    TEdgeSlotThread thr(options);
+    TTestSlot slt;
+    thr.GrabObject(&slt);
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    auto mailbox = thr.GetMailbox();
+    CHECK(mailbox->IsBusyPolling());
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 3);
+
+    // back to waiting on the wakeup and then spinning again
+    mailbox->SetBusyPoll(false);
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 6);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    mailbox->SetBusyPoll(true);
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 9);
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+class TSharedEdgeHolder: public TEdgeSlotObject {
+public:
+    bsc::TSharedEdge<int, int> Edge{this};
+};
+
+
+TEST(EDGE_SLOT_THREAD, SharedEdgeEmitsFromAnyThread) {
+    TEdgeSlotThread thr;
+    TThreadRecorder rec;
+    TThreadRecorder extra;
+    thr.GrabObject(&rec);
+    thr.GrabObject(&extra);
+
+    TSharedEdgeHolder holder;
+    Connect(&holder, &holder.Edge, &rec, &rec.Slot);
+
+    std::vector<std::thread> emitters;
+    for (int i = 0; i < 4; ++i)
+        emitters.emplace_back([&]() {
+            for (int i = 0; i < 1000; ++i)
+                holder.Edge.emit(1, 2);
+        });
+    // connections change in the thread of the edge meanwhile
+    for (int i = 0; i < 100; ++i) {
+        Connect(&holder, &holder.Edge, &extra, &extra.Slot);
+        holder.Edge.disconnect(&extra.Slot);
+    }
+    for (auto& emitter: emitters)
+        emitter.join();
+
+    TTestEdge barrier;
+    Connect(&barrier, &barrier.Edge, &rec, &rec.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    Connect(&barrier, &barrier.Edge, &extra, &extra.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+    CHECK(rec.Counter == 12000);
+    CHECK(rec.Thread == thr.get_id());
+    CHECK(extra.Counter % 3 == 0);
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+TEST(EDGE_SLOT, ConnectOnce) {
+    TTestEdge sig;
+    TTestSlot slt;
+    ConnectOnce(&sig, &sig.Edge, &slt, &slt.Slot);
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot);
+    CHECK(slt.Slot.is_connected());
+
+    sig.Edge.emit(1, 2);
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 9);
+
+    // the regular connection is still there
+    Disconnect(&sig, &sig.Edge, &slt, &slt.Slot);
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 9);
+
+    // a slot destroyed before the signal is skipped
+    {
+        TTestSlot gone;
+        ConnectOnce(&sig, &sig.Edge, &gone, &gone.Slot);
+    }
+    sig.Edge.emit(1, 2);
+}
+
+
+TEST(EDGE_SLOT_THREAD, ConnectOnceFromManyThreads) {
+    TEdgeSlotThread thr;
+    TTestSlot slt;
+    thr.GrabObject(&slt);
+    TSharedEdgeHolder holder;
+    ConnectOnce(&holder, &holder.Edge, &slt, &slt.Slot);
+
+    std::vector<std::thread> emitters;
+    for (int i = 0; i < 4; ++i)
+        emitters.emplace_back([&]() {
+            for (int i = 0; i < 100; ++i)
+                holder.Edge.emit(1, 2);
+        });
+    for (auto& emitter: emitters)
+        emitter.join();
+
+    TTestEdge barrier;
+    Connect(&barrier, &barrier.Edge, &slt, &slt.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+    CHECK(slt.Counter == 3);
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+TEST(EDGE_SLOT_THREAD, FilteredConnection) {
+    TEdgeSlotThread thr;
+    TTestSlot slt;
+    thr.GrabObject(&slt);
+    TTestEdge sig;
+    std::thread::id filtered_in;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::AUTO,
+            [&](int a, int) {
+                filtered_in = std::this_thread::get_id();
+                return a % 10 == 0;
+            });
+
+    auto mailbox = thr.GetMailbox();
+    TTestEdge barrier;
+    Connect(&barrier, &barrier.Edge, &slt, &slt.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+    auto before = mailbox->GetDequeued();
+
+    // only the accepted signals are queued
+    for (int i = 0; i < 100; ++i)
+        sig.Edge.emit(i, 1);
+    barrier.Edge.emit(0, 0);
+    CHECK(slt.Counter == 460);
+    CHECK(mailbox->GetDequeued() - before == 11);
+    CHECK(filtered_in == std::this_thread::get_id());
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+class TKeyedHolder: public TEdgeSlotObject {
+public:
+    void fire(int key, int value) {
+        Edge.emit(key, value);
+    }
+
+    DEFINE_SLOT(TKeyedHolder, fire, FireSlot);
+
+    bsc::TKeyedEdge<int, int> Edge{this};
+};
+
+
+TEST(EDGE_SLOT, KeyedEdge) {
+    TKeyedHolder holder;
+    TTestSlot one;
+    TTestSlot two;
+    TTestSlot any;
+    bsc::ConnectKey(&holder, &holder.Edge, 1, &one, &one.Slot);
+    bsc::ConnectKey(&holder, &holder.Edge, 2, &two, &two.Slot);
+    bsc::ConnectAnyKey(&holder, &holder.Edge, &any, &any.Slot);
+    CHECK(holder.Edge.GetKeyCount() == 2);
+
+    holder.Edge.emit(1, 10);
+    holder.Edge.emit(3, 10);
+    CHECK(one.Counter == 11);
+    CHECK(two.Counter == 0);
+    CHECK(any.Counter == 24);
+
+    bsc::DisconnectKey(&holder, &holder.Edge, 1, &one, &one.Slot);
+    CHECK(holder.Edge.GetKeyCount() == 1);
+    holder.Edge.emit(1, 10);
+    CHECK(one.Counter == 11);
+
+    // the key of a destroyed slot is dropped by the next emit
+    {
+        TTestSlot gone;
+        bsc::ConnectKey(&holder, &holder.Edge, 5, &gone, &gone.Slot);
+        CHECK(holder.Edge.GetKeyCount() == 2);
+    }
+    holder.Edge.emit(5, 0);
+    CHECK(holder.Edge.GetKeyCount() == 1);
+
+    Disconnect(&holder, holder.Edge.any(), &any, &any.Slot);
+    holder.Edge.emit(2, 0);
+    CHECK(two.Counter == 2);
+    CHECK(any.Counter == 40);
+}
+
+
+TEST(EDGE_SLOT_THREAD, KeyedEdgeSubscribesFromOtherThread) {
+    TEdgeSlotThread thr;
+    TKeyedHolder holder;
+    thr.GrabObject(&holder);
+    TTestSlot slt;
+    bsc::ConnectKey(&holder, &holder.Edge, 7, &slt, &slt.Slot);
+
+    TTestEdge trigger;
+    Connect(&trigger, &trigger.Edge, &holder, &holder.FireSlot);
+    trigger.Edge.emit(6, 1);
+    trigger.Edge.emit(7, 1);
+    TEdgeSlotThread::MessageLoop([&]() { return slt.Counter == 0; });
+    CHECK(slt.Counter == 8);
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+class TKeyedWorker: public TEdgeSlotObject {
+public:
+    void work(int key, int seq) {
+        auto last = Last.find(key);
+        if (last != Last.end() && last->second >= seq)
+            ++Violations;
+        Last[key] = seq;
+        Thread = std::this_thread::get_id();
+        Done.fetch_add(1);
+    }
+
+    DEFINE_SLOT(TKeyedWorker, work, Slot);
+
+    std::map<int, int> Last;
+    int Violations = 0;
+    std::thread::id Thread;
+    std::atomic<int> Done = {0};
+};
+
+
+TEST(EDGE_SLOT_THREAD, PartitionedSlotKeepsKeyOrder) {
+    bsc::TPartitionedSlot<TKeyedWorker, 0, int, int>::TOptions options;
+    options.Partitions = 2;
+    bsc::TPartitionedSlot<TKeyedWorker, 0, int, int> part(
+        &TKeyedWorker::Slot, options);
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &part, &part.Slot);
+
+    for (int seq = 0; seq < 100; ++seq)
+        for (int key = 0; key < 8; ++key)
+            sig.Edge.emit(key, seq);
+
+    auto done = [&]() {
+        return part.GetReplica(0)->Done + part.GetReplica(1)->Done;
+    };
+    while (done() < 800)
+        std::this_thread::yield();
+
+    // every key stays in one replica, in order
+    for (size_t i = 0; i < part.size(); ++i) {
+        auto replica = part.GetReplica(i);
+        CHECK(replica->Violations == 0);
+        CHECK(replica->Thread == part.GetThread(i)->get_id());
+        for (const auto& key: replica->Last) {
+            CHECK(part.GetPartition(key.first) == i);
+            CHECK(key.second == 99);
+        }
+    }
+    CHECK(part.GetReplica(0)->Last.size() == 4);
+    CHECK(part.GetReplica(1)->Last.size() == 4);
+}
+
+
+class TIndexedWorker: public TEdgeSlotObject {
+public:
+    explicit TIndexedWorker(size_t index)
+        : Index(index)
+    {}
+
+    void work(int key, int) {
+        Keys.push_back(key);
+        Done.fetch_add(1);
+    }
+
+    DEFINE_SLOT(TIndexedWorker, work, Slot);
+
+    size_t Index;
+    std::vector<int> Keys;
+    std::atomic<int> Done = {0};
+};
+
+
+TEST(EDGE_SLOT_THREAD, PartitionedSlotFactory) {
+    using TPart = bsc::TPartitionedSlot<TIndexedWorker, 0, int, int>;
+    TPart::TOptions options;
+    options.Partitions = 3;
+    TPart part(&TIndexedWorker::Slot, options, [](size_t index) {
+        return std::unique_ptr<TIndexedWorker>(new TIndexedWorker(index));
+    });
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &part, &part.Slot);
+
+    for (int key = 0; key < 30; ++key)
+        sig.Edge.emit(key, 0);
+
+    auto done = [&]() {
+        int sum = 0;
+        for (size_t i = 0; i < part.size(); ++i)
+            sum += part.GetReplica(i)->Done;
+        return sum;
+    };
+    while (done() < 30)
+        std::this_thread::yield();
+
+    for (size_t i = 0; i < part.size(); ++i) {
+        auto replica = part.GetReplica(i);
+        CHECK(replica->Index == i);
+        for (auto key: replica->Keys)
+            CHECK(part.GetPartition(key) == i);
+    }
+}
+
+
+class TSlowWorker: public TEdgeSlotObject {
+public:
+    ~TSlowWorker() {
+        Destroyed.fetch_add(1);
+    }
+
+    void work(int, int) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    DEFINE_SLOT(TSlowWorker, work, Slot);
+
+    static std::atomic<int> Destroyed;
+};
+
+
+std::atomic<int> TSlowWorker::Destroyed = {0};
+
+
+TEST(EDGE_SLOT_THREAD, PartitionedSlotTeardown) {
+    TSlowWorker::Destroyed = 0;
+    {
+        bsc::TPartitionedSlot<TSlowWorker, 0, int, int>::TOptions options;
+        options.Partitions = 2;
+        bsc::TPartitionedSlot<TSlowWorker, 0, int, int> part(
+            &TSlowWorker::Slot, options);
+        TTestEdge sig;
+        Connect(&sig, &sig.Edge, &part, &part.Slot);
+
+        // the partitioned slot goes away with signals still in flight
+        for (int key = 0; key < 1000; ++key)
+            sig.Edge.emit(key, 0);
+    }
+    CHECK(TSlowWorker::Destroyed == 2);
+}
+
+class TCreditSlot: public TEdgeSlotObject {
+public:
+    void take(int a, int) {
+        if (Gate.valid())
+            Gate.wait();
+        Values.push_back(a);
+    }
+
+    DEFINE_SLOT(TCreditSlot, take, Slot);
+
+    std::shared_future<void> Gate;
+    std::vector<int> Values;
+};
+
+
+TEST(EDGE_SLOT_THREAD, CreditWindows) {
+    TEdgeSlotThread thr;
+    TCreditSlot conflated;
+    TCreditSlot reported;
+    TCreditSlot dropped;
+    std::promise<void> open;
+    conflated.Gate = open.get_future().share();
+    thr.GrabObject(&conflated);
+    thr.GrabObject(&reported);
+    thr.GrabObject(&dropped);
+
+    TTestEdge sig;
+    auto conflate = bsc::ConnectWithCredits(&sig, &sig.Edge, &conflated,
+        &conflated.Slot, 1, bsc::BACKPRESSURE::CONFLATE);
+    auto report = bsc::ConnectWithCredits(&sig, &sig.Edge, &reported,
+        &reported.Slot, 2, bsc::BACKPRESSURE::REPORT);
+    auto drop = bsc::ConnectWithCredits(&sig, &sig.Edge, &dropped,
+        &dropped.Slot, 1, bsc::BACKPRESSURE::DROP);
+
+    // the thread is stuck in the first signal
+    CHECK(sig.Edge.try_emit(1, 0));
+    CHECK(sig.Edge.try_emit(2, 0));
+    CHECK(!sig.Edge.try_emit(3, 0));
+    CHECK(!sig.Edge.try_emit(4, 0));
+    CHECK(conflate->GetInFlight() == 1);
+    CHECK(conflate->GetConflated() == 2);
+    CHECK(report->GetInFlight() == 2);
+    CHECK(report->GetRefused() == 2);
+    CHECK(drop->GetDropped() == 3);
+
+    open.set_value();
+    TTestEdge barrier;
+    TCreditSlot last;
+    thr.GrabObject(&last);
+    Connect(&barrier, &barrier.Edge, &last, &last.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+
+    // the last conflated signal follows the one that drained the window
+    CHECK(conflated.Values == std::vector<int>({1, 4}));
+    CHECK(reported.Values == std::vector<int>({1, 2}));
+    CHECK(dropped.Values == std::vector<int>({1}));
+    CHECK(conflate->GetInFlight() == 0);
+    CHECK(report->GetInFlight() == 0);
+    CHECK(sig.Edge.try_emit(5, 0));
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+TEST(EDGE_SLOT, SignalTtl) {
+    TEdgeSlotThread::ResetLoopStats();
+    TTestEdge sig;
+    TCreditSlot slt;
+    bsc::TConnectOptions<int, int> options;
+    options.Ttl = 20000;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE, options);
+
+    // a backlog older than the TTL is dropped unconsumed
+    sig.Edge.emit(1, 0);
+    sig.Edge.emit(2, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    sig.Edge.emit(3, 0);
+    TEdgeSlotThread::MessageLoop([&]() { return slt.Values.empty(); });
+    CHECK(slt.Values == std::vector<int>({3}));
+    CHECK(TEdgeSlotThread::GetLoopStats().ExpiredSignals == 2);
+    TEdgeSlotThread::ResetLoopStats();
+}
+
+
+TEST(EDGE_SLOT, ConflatedSignalTtl) {
+    TEdgeSlotThread::ResetLoopStats();
+    TTestEdge sig;
+    TCreditSlot slt;
+    bsc::TConnectOptions<int, int> options;
+    options.Ttl = 50000;
+    options.Credits = std::make_shared<bsc::TCreditWindow<int, int>>(
+        1, bsc::BACKPRESSURE::CONFLATE);
+    auto window = options.Credits;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE, options);
+    auto in_flight = [&]() { return window->GetInFlight() != 0; };
+
+    // the conflated signal keeps the deadline of its own emit
+    sig.Edge.emit(1, 0);
+    sig.Edge.emit(2, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    sig.Edge.emit(3, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    TEdgeSlotThread::MessageLoop(in_flight);
+    CHECK(slt.Values == std::vector<int>({3}));
+    CHECK(TEdgeSlotThread::GetLoopStats().ExpiredSignals == 1);
+
+    sig.Edge.emit(4, 0);
+    sig.Edge.emit(5, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    TEdgeSlotThread::MessageLoop(in_flight);
+    CHECK(slt.Values == std::vector<int>({3}));
+    CHECK(TEdgeSlotThread::GetLoopStats().ExpiredSignals == 3);
+
+    TEdgeSlotThread::ResetLoopStats();
+}
+
+
+TEST(EDGE_SLOT_THREAD, SignalTtlAcrossClocks) {
+    // the clocks of the emitter and the consumer do not matter
+    TEdgeSlotThread::SetClockSource(std::make_shared<bsc::TVirtualClock>(0));
+    TEdgeSlotThread::TOptions thread_options;
+    thread_options.Clock = std::make_shared<bsc::TVirtualClock>((ui64) 1 << 62);
+    TEdgeSlotThread thr(thread_options);
+    TTestEdge sig;
+    TCreditSlot slt;
+    std::promise<void> open;
+    slt.Gate = open.get_future().share();
+    thr.GrabObject(&slt);
+    bsc::TConnectOptions<int, int> options;
+    options.Ttl = 20000;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE, options);
+
+    // 2 waits behind 1 for longer than the TTL
+    sig.Edge.emit(1, 0);
+    sig.Edge.emit(2, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    sig.Edge.emit(3, 0);
+    open.set_value();
+    TTestEdge barrier;
+    TCreditSlot last;
+    thr.GrabObject(&last);
+    Connect(&barrier, &barrier.Edge, &last, &last.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+    CHECK(slt.Values == std::vector<int>({1, 3}));
+
+    thr.PostQuitMessage();
+    thr.join();
+    TEdgeSlotThread::SetClockSource(nullptr);
+}
+
+
+TEST(EDGE_SLOT, DisconnectDropsQueuedSignals) {
+    TTestEdge sig;
+    TCreditSlot slt;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE);
+    sig.Edge.emit(1, 0);
+    sig.Edge.emit(2, 0);
+    Disconnect(&sig, &sig.Edge, &slt, &slt.Slot);
+
+    // signals of the old connection do not leak into the new one
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE);
+    sig.Edge.emit(3, 0);
+    TEdgeSlotThread::MessageLoop([&]() { return slt.Values.empty(); });
+    CHECK(slt.Values == std::vector<int>({3}));
+}
+
+
+TEST(EDGE_SLOT, DestroyedEdgeDropsQueuedSignals) {
+    TCreditSlot slt;
+    std::unique_ptr<TTestEdge> gone(new TTestEdge);
+    Connect(gone.get(), &gone->Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE);
+    gone->Edge.emit(1, 0);
+    gone->Edge.emit(2, 0);
+    gone.reset();
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot, bsc::DELIVERY::QUEUE);
+    sig.Edge.emit(3, 0);
+    TEdgeSlotThread::MessageLoop([&]() { return slt.Values.empty(); });
+    CHECK(slt.Values == std::vector<int>({3}));
+}
+
+
+TEST(EDGE_SLOT_THREAD, DisconnectDropsSignalsInFlight) {
+    TEdgeSlotThread thr;
+    TCreditSlot slt;
+    std::promise<void> open;
+    slt.Gate = open.get_future().share();
+    thr.GrabObject(&slt);
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &slt, &slt.Slot);
+    for (int i = 1; i <= 3; ++i)
+        sig.Edge.emit(i, 0);
+    DisconnectFromEdge(&sig, &sig.Edge, &slt, &slt.Slot);
+
+    open.set_value();
+    TTestEdge barrier;
+    TCreditSlot last;
+    thr.GrabObject(&last);
+    Connect(&barrier, &barrier.Edge, &last, &last.Slot,
+            bsc::DELIVERY::BLOCK_QUEUE);
+    barrier.Edge.emit(0, 0);
+
+    // only the signal that was being consumed may have got through
+    CHECK(slt.Values.empty() || slt.Values == std::vector<int>({1}));
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+class TAdder: public TEdgeSlotObject {
+public:
+    int sum(int a, int b) {
+        if (a < 0)
+            throw std::invalid_argument("negative");
+        Thread = std::this_thread::get_id();
+        return a + b;
+    }
+
+    void store(int value) {
+        if (value < 0)
+            throw std::invalid_argument("negative");
+        Stored = value;
+    }
+
+    DEFINE_REPLY_SLOT(TAdder, sum, SumSlot);
+    DEFINE_REPLY_SLOT(TAdder, store, StoreSlot);
+
+    std::thread::id Thread;
+    int Stored = 0;
+};
+
+
+class TReplyCollector: public TEdgeSlotObject {
+public:
+    void Collect(bsc::TFuture<int> reply) {
+        Thread = std::this_thread::get_id();
+        try {
+            Results.push_back(reply.Get());
+        } catch (std::invalid_argument&) {
+            Results.push_back(-1);
+        }
+    }
+
+    std::vector<int> Results;
+    std::thread::id Thread;
+};
+
+
+TEST(EDGE_SLOT_THREAD, RequestReply) {
+    TEdgeSlotThread thr;
+    TAdder adder;
+    thr.GrabObject(&adder);
+    TReplyCollector collector;
+    auto collect = [&](bsc::TFuture<int> reply) { collector.Collect(reply); };
+
+    auto first = adder.SumSlot.request(1, 2);
+    first.Then(&collector, collect);
+    auto failed = adder.SumSlot.request(-1, 2);
+    failed.Then(&collector, collect);
+
+    // the replies come to the thread of the collector
+    TEdgeSlotThread::MessageLoop([&]() { return collector.Results.size() < 2; });
+    CHECK(collector.Results == std::vector<int>({3, -1}));
+    CHECK(collector.Thread == std::this_thread::get_id());
+    CHECK(adder.Thread == thr.get_id());
+    CHECK(first.IsReady() && first.Get() == 3);
+
+    thr.PostQuitMessage();
+    thr.join();
+
+    // a local object replies at once
+    adder.GetAnchor().MoveToLocalThread();
+    auto local = adder.SumSlot.request(2, 2);
+    CHECK(local.IsReady() && local.Get() == 4);
+    local.Then(&collector, collect);
+    TEdgeSlotThread::MessageLoop([&]() { return collector.Results.size() < 3; });
+    CHECK(collector.Results.back() == 4);
+}
+
+
+TEST(EDGE_SLOT_THREAD, VoidRequestReply) {
+    TEdgeSlotThread thr;
+    TAdder adder;
+    thr.GrabObject(&adder);
+    TReplyCollector collector;
+    std::vector<int> done;
+    auto check = [&](bsc::TFuture<void> reply) {
+        try {
+            reply.Get();
+            done.push_back(1);
+        } catch (std::invalid_argument&) {
+            done.push_back(-1);
+        }
+    };
+
+    // the reply only tells that the slot has finished
+    adder.StoreSlot.request(5).Then(&collector, check);
+    adder.StoreSlot.request(-5).Then(&collector, check);
+    TEdgeSlotThread::MessageLoop([&]() { return done.size() < 2; });
+    CHECK(done == std::vector<int>({1, -1}));
+    CHECK(adder.Stored == 5);
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+
+
+#if defined(__cpp_impl_coroutine)
+static bsc::TTask AwaitSignalsAndReplies(
+        bsc::TAwaitableSlot<int, int>* signals, TAdder* adder,
+        std::shared_ptr<bsc::TMailbox> other, std::vector<int>* log,
+        std::thread::id* visited)
+{
+    auto [a, b] = co_await *signals;
+    log->push_back(a + b);
+    log->push_back(co_await adder->SumSlot.request(a, b));
+    co_await adder->StoreSlot.request(a + b);
+    try {
+        co_await adder->SumSlot.request(-1, 0);
+    } catch (std::invalid_argument&) {
+        log->push_back(-1);
+    }
+
+    auto home = TEdgeSlotThread::LocalMailbox;
+    auto [c, d] = co_await *signals;
+    co_await bsc::ResumeIn(other);
+    *visited = std::this_thread::get_id();
+    co_await bsc::ResumeIn(home);
+    log->push_back(c + d);
+}
+
+
+TEST(EDGE_SLOT_THREAD, CoroutineAwaitsSignalsAndReplies) {
+    TEdgeSlotThread thr;
+    TAdder adder;
+    thr.GrabObject(&adder);
+    TTestEdge sig;
+    bsc::TAwaitableSlot<int, int> signals;
+    Connect(&sig, &sig.Edge, &signals, &signals.Slot);
+
+    // a signal that comes before the wait is kept
+    sig.Edge.emit(1, 2);
+    std::vector<int> log;
+    std::thread::id visited;
+    AwaitSignalsAndReplies(&signals, &adder, thr.GetMailbox(), &log, &visited);
+    CHECK(log == std::vector<int>({3}));
+
+    TEdgeSlotThread::MessageLoop([&]() { return !signals.IsWaiting(); });
+    CHECK(log == std::vector<int>({3, 3, -1}));
+    CHECK(adder.Stored == 3);
+    CHECK(signals.GetPending() == 0);
+
+    sig.Edge.emit(4, 4);
+    TEdgeSlotThread::MessageLoop([&]() { return log.size() < 4; });
+    CHECK(log.back() == 8);
+    CHECK(visited == thr.get_id());
+
+    thr.PostQuitMessage();
+    thr.join();
+}
+#endif
+
+
+class TSleepySlot: public TEdgeSlotObject {
+public:
+    void nap(int ms, int) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        ++Naps;
+    }
+
+    DEFINE_SLOT(TSleepySlot, nap, Slot);
+
+    int Naps = 0;
+};
+
+
+TEST(EDGE_SLOT_THREAD, BlockQueueFanOutWaitsOnce) {
+    TEdgeSlotThread first;
+    TEdgeSlotThread second;
+    TSleepySlot one;
+    TSleepySlot two;
+    first.GrabObject(&one);
+    second.GrabObject(&two);
+
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &one, &one.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    Connect(&sig, &sig.Edge, &two, &two.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+
+    // both slots nap at the same time
+    auto start = TEdgeSlotThread::GetNow();
+    sig.Edge.emit(100, 0);
+    auto elapsed = TEdgeSlotThread::GetNow() - start;
+    CHECK(one.Naps == 1 && two.Naps == 1);
+    CHECK(elapsed >= 100000);
+    CHECK(elapsed < 190000);
+
+    // the latch is reused
+    sig.Edge.emit(0, 0);
+    CHECK(one.Naps == 2 && two.Naps == 2);
+
+    first.PostQuitMessage();
+    second.PostQuitMessage();
+    first.join();
+    second.join();
+}
+
+
+class TEchoSlot: public TEdgeSlotObject {
+public:
+    void echo(int a, int b) {
+        Edge.emit(a, b);
+    }
+
+    DEFINE_SLOT(TEchoSlot, echo, Slot);
+
+    TEdge<int, int> Edge = TEdge<int, int>(this);
+};
+
+
+TEST(EDGE_SLOT_THREAD, BlockQueuePumpsWhileWaiting) {
+    bsc::TLoopPolicy policy;
+    policy.PumpDepth = 1;
+    TEdgeSlotThread::SetLoopPolicy(policy);
+    TEdgeSlotThread::ResetLoopStats();
+
+    TEdgeSlotThread thr;
+    TEchoSlot echo;
+    TTestSlot slt;
+    thr.GrabObject(&echo);
+    TTestEdge sig;
+    Connect(&sig, &sig.Edge, &echo, &echo.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+    Connect(&echo, &echo.Edge, &slt, &slt.Slot, bsc::DELIVERY::BLOCK_QUEUE);
+
+    // the echo blocks on this thread, which keeps consuming its messages
+    sig.Edge.emit(1, 2);
+    CHECK(slt.Counter == 3);
+    CHECK(TEdgeSlotThread::GetLoopStats().PumpedWaits == 1);
+
+    thr.PostQuitMessage();
+    thr.join();
+    TEdgeSlotThread::SetLoopPolicy(bsc::TLoopPolicy());
+    TEdgeSlotThread::ResetLoopStats();
+}
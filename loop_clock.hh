@@ -0,0 +1,186 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "syscall.hh"
+#include "types.hh"
+#include "compiler.hh"
+#include <atomic>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#endif
+
+
+namespace bsc {
+
+
+// Source of time for message loops and timers, all values are microseconds.
+class IClockSource {
+public:
+    virtual ~IClockSource() noexcept = default;
+
+    virtual ui64 GetNow() = 0;
+
+    // true if values are comparable with CLOCK_MONOTONIC (required by timerfd)
+    virtual bool IsMonotonic() const noexcept {
+        return true;
+    }
+};
+
+
+class TMonotonicClock: public IClockSource {
+public:
+    virtual ui64 GetNow() override {
+        return Now();
+    }
+
+    static ui64 Now() {
+        timespec ts;
+        int res = ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        ESyscallError::Validate(res, "clock_gettime");
+        return (ui64) ts.tv_sec * 1000000 + (ui64) ts.tv_nsec / 1000;
+    }
+
+    static ui64 NowNs() {
+        timespec ts;
+        int res = ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        ESyscallError::Validate(res, "clock_gettime");
+        return (ui64) ts.tv_sec * 1000000000 + (ui64) ts.tv_nsec;
+    }
+};
+
+
+// Extrapolates CLOCK_MONOTONIC by the time stamp counter and resyncs with it
+// every resync_period microseconds to correct the drift. Not thread safe,
+// use one instance per thread.
+class TTscClock: public IClockSource {
+public:
+    explicit TTscClock(ui64 resync_period = 100000 /* in microseconds */)
+        : ResyncPeriod(resync_period < MAX_RESYNC_PERIOD
+                       ? resync_period
+                       : MAX_RESYNC_PERIOD)
+    {
+        BaseTime = TMonotonicClock::Now();
+        BaseTsc = ReadTsc();
+
+        ui64 now;
+        ui64 tsc;
+        do {
+            now = TMonotonicClock::Now();
+            tsc = ReadTsc();
+        } while (now - BaseTime < CALIBRATION_TIME);
+
+        Calibrate(now, tsc);
+        Last = now;
+    }
+
+    virtual ui64 GetNow() override {
+        ui64 tsc = ReadTsc();
+        ui64 delta = tsc - BaseTsc;
+        if (NOWAY(delta >= ResyncTicks))
+            return Resync(tsc);
+
+        // delta < ResyncTicks guarantees no overflow
+        ui64 now = BaseTime + ((delta * Mult) >> SHIFT);
+        if (now < Last)
+            return Last;
+        return Last = now;
+    }
+
+    static ui64 ReadTsc() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return TMonotonicClock::NowNs();
+#endif
+    }
+
+protected:
+    static constexpr ui32 SHIFT = 32;
+    static constexpr ui64 CALIBRATION_TIME = 1000;
+    static constexpr ui64 MAX_RESYNC_PERIOD = 1000000000;
+
+    const ui64 ResyncPeriod;
+    ui64 BaseTime;
+    ui64 BaseTsc;
+    ui64 Mult = 0;
+    ui64 ResyncTicks = 0;
+    ui64 Last;
+
+    void Calibrate(ui64 now, ui64 tsc) noexcept {
+        double ticks = (double) (tsc - BaseTsc);
+        double us = (double) (now - BaseTime);
+        if (ticks > 0 && us > 0) {
+            Mult = (ui64) (us * (double) (1ull << SHIFT) / ticks);
+            ResyncTicks = (ui64) (ResyncPeriod * ticks / us);
+        }
+        if (Mult == 0)
+            Mult = 1;
+        if (ResyncTicks == 0)
+            ResyncTicks = 1;
+        BaseTime = now;
+        BaseTsc = tsc;
+    }
+
+    COLD ui64 Resync(ui64 tsc) {
+        ui64 now = TMonotonicClock::Now();
+        Calibrate(now, tsc);
+        if (now < Last)
+            return Last;
+        return Last = now;
+    }
+};
+
+
+// Time that is moved only by hand, may be shared between threads.
+class TVirtualClock: public IClockSource {
+public:
+    explicit TVirtualClock(ui64 now = 0)
+        : Now(now)
+    {}
+
+    virtual ui64 GetNow() override {
+        return Now.load(std::memory_order_acquire);
+    }
+
+    virtual bool IsMonotonic() const noexcept override {
+        return false;
+    }
+
+    void Set(ui64 now) noexcept {
+        Now.store(now, std::memory_order_release);
+    }
+
+    void Advance(ui64 delta) noexcept {
+        Now.fetch_add(delta, std::memory_order_acq_rel);
+    }
+
+protected:
+    std::atomic<ui64> Now;
+};
+
+
+} // namespace bsc
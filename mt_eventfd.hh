@@ -0,0 +1,70 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "syscall.hh"
+#include "types.hh"
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+namespace bsc {
+
+class TEventFd {
+public:
+    TEventFd() {
+        Fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ESyscallError::Validate(Fd, "eventfd");
+    }
+
+    ~TEventFd() {
+        ::close(Fd);
+    }
+
+    TEventFd(const TEventFd&) = delete;
+    void operator=(const TEventFd&) = delete;
+
+    void Post() {
+        ui64 one = 1;
+        auto res = ::write(Fd, &one, sizeof(one));
+        // EAGAIN means the counter is saturated, the waiter wakes anyway
+        if (res == -1 && errno != EAGAIN)
+            throw ESyscallError("eventfd_write");
+    }
+
+    void Drain() noexcept {
+        ui64 value;
+        auto res = ::read(Fd, &value, sizeof(value));
+        (void) res;
+    }
+
+    int GetFd() const noexcept {
+        return Fd;
+    }
+
+protected:
+    int Fd;
+};
+
+} // namespace bsc
@@ -0,0 +1,87 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "mt_semaphore.hh"
+#include <atomic>
+
+
+namespace bsc {
+
+// Counts down outstanding operations, the owner waits until all of them
+// have completed. The owner holds one count of its own, so the semaphore
+// is posted only if the owner is already waiting or about to wait.
+// A latch may be reset and used again once Wait() has returned.
+class TCountdownLatch {
+public:
+    TCountdownLatch() = default;
+
+    TCountdownLatch(const TCountdownLatch&) = delete;
+    void operator=(const TCountdownLatch&) = delete;
+
+    // owner only, before any Add()
+    void Reset() noexcept {
+        Count.store(1, std::memory_order_relaxed);
+    }
+
+    // owner only, before the operation is started
+    void Add() noexcept {
+        Count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // returns true if it was the last count
+    bool CountDown() {
+        if (Count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return false;
+        Sem.Post();
+        return true;
+    }
+
+    bool Done() const noexcept {
+        return Count.load(std::memory_order_acquire) == 0;
+    }
+
+    // owner only, drops the count of the owner, returns true if no other
+    // count is left. Otherwise call WaitArrived() before the next Reset().
+    bool Arrive() noexcept {
+        return Count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    // owner only, after Arrive() has returned false
+    void WaitArrived() {
+        Sem.Wait();
+    }
+
+    // owner only, drops the count of the owner and waits for the rest
+    void Wait() {
+        if (!Arrive())
+            WaitArrived();
+    }
+
+protected:
+    std::atomic<ui32> Count = {1};
+    TSemaphore Sem;
+};
+
+} // namespace bsc
@@ -64,6 +64,11 @@ public:
         return true;
     }
 
+    // consumer side only
+    bool empty() const noexcept {
+        return head->next.load(std::memory_order_acquire) == nullptr;
+    }
+
 protected:
     struct Elem {
         Elem(): next(nullptr) {}
@@ -60,7 +60,7 @@ public:
 
         ts.tv_sec += wait_time / 1000000;
         ts.tv_nsec += (wait_time % 1000000) * 1000;
-        if (ts.tv_nsec > 1000000000) {
+        if (ts.tv_nsec >= 1000000000) {
             ++ts.tv_sec;
             ts.tv_nsec -= 1000000000;
         }
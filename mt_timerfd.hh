@@ -0,0 +1,81 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "syscall.hh"
+#include "types.hh"
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+namespace bsc {
+
+class TTimerFd {
+public:
+    TTimerFd() {
+        Fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ESyscallError::Validate(Fd, "timerfd_create");
+    }
+
+    ~TTimerFd() {
+        ::close(Fd);
+    }
+
+    TTimerFd(const TTimerFd&) = delete;
+    void operator=(const TTimerFd&) = delete;
+
+    // deadline is an absolute CLOCK_MONOTONIC time in microseconds
+    void Arm(ui64 deadline) {
+        // an earlier expiration wakes the waiter anyway, it will rearm
+        if (Armed != 0 && Armed <= deadline)
+            return;
+
+        itimerspec spec = {};
+        spec.it_value.tv_sec = deadline / 1000000;
+        spec.it_value.tv_nsec = (deadline % 1000000) * 1000;
+        if (deadline == 0)
+            spec.it_value.tv_nsec = 1; // zero disarms the timer
+
+        int res = ::timerfd_settime(Fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        ESyscallError::Validate(res, "timerfd_settime");
+        Armed = deadline;
+    }
+
+    void Drain() noexcept {
+        ui64 expirations;
+        auto res = ::read(Fd, &expirations, sizeof(expirations));
+        (void) res;
+        Armed = 0;
+    }
+
+    int GetFd() const noexcept {
+        return Fd;
+    }
+
+protected:
+    int Fd;
+    ui64 Armed = 0;
+};
+
+} // namespace bsc
@@ -0,0 +1,94 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "types.hh"
+#include <memory>
+#include <utility>
+#include <stddef.h>
+
+
+namespace bsc {
+
+
+// Single-threaded FIFO queue over a circular buffer. The capacity is
+// a power of two and doubles when the buffer is full.
+template <typename TItem>
+class TRingQueue {
+public:
+    explicit TRingQueue(size_t capacity = 64) {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        Items.reset(new TItem[size]);
+        Mask = size - 1;
+    }
+
+    TRingQueue(const TRingQueue&) = delete;
+    void operator=(const TRingQueue&) = delete;
+
+    bool empty() const noexcept {
+        return Head == Tail;
+    }
+
+    size_t size() const noexcept {
+        return Tail - Head;
+    }
+
+    void push(TItem item) {
+        if (Tail - Head > Mask)
+            Grow();
+        Items[Tail++ & Mask] = std::move(item);
+    }
+
+    bool pop(TItem* item) {
+        if (Head == Tail)
+            return false;
+        *item = std::move(Items[Head++ & Mask]);
+        return true;
+    }
+
+    void clear() {
+        TItem item;
+        while (pop(&item)); // empty loop
+    }
+
+protected:
+    std::unique_ptr<TItem[]> Items;
+    size_t Mask = 0;
+    size_t Head = 0;
+    size_t Tail = 0;
+
+    void Grow() {
+        auto size = (Mask + 1) * 2;
+        std::unique_ptr<TItem[]> items(new TItem[size]);
+        for (size_t i = Head; i != Tail; ++i)
+            items[i & (size - 1)] = std::move(Items[i & Mask]);
+        Items = std::move(items);
+        Mask = size - 1;
+    }
+};
+
+
+} // namespace bsc
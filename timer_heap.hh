@@ -0,0 +1,172 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "types.hh"
+#include <vector>
+#include <stddef.h>
+
+
+namespace bsc {
+
+
+// Items of TTimerHeap keep their own position inside the heap, this makes
+// removal of an arbitrary item O(log n) without searching for it.
+class TTimerHeapHook {
+public:
+    static constexpr size_t NOT_QUEUED = ~(size_t) 0;
+
+    bool IsQueued() const noexcept {
+        return TimerHeapIndex != NOT_QUEUED;
+    }
+
+protected:
+    size_t TimerHeapIndex = NOT_QUEUED;
+
+    template <typename TItem>
+    friend class TTimerHeap;
+};
+
+
+// 4-ary min-heap ordered by TItem::GetDeadline(),
+// TItem must be derived from TTimerHeapHook.
+template <typename TItem>
+class TTimerHeap {
+public:
+    static constexpr size_t ARITY = 4;
+
+    bool empty() const noexcept {
+        return Items.empty();
+    }
+
+    size_t size() const noexcept {
+        return Items.size();
+    }
+
+    TItem* top() const noexcept {
+        return Items.front();
+    }
+
+    void push(TItem* item) {
+        if (item->IsQueued()) {
+            update(item);
+            return;
+        }
+        Items.push_back(item);
+        item->TimerHeapIndex = Items.size() - 1;
+        SiftUp(Items.size() - 1);
+    }
+
+    void pop() noexcept {
+        RemoveAt(0);
+    }
+
+    // restore heap order after the deadline of a queued item has changed
+    void update(TItem* item) noexcept {
+        auto index = item->TimerHeapIndex;
+        if (index > 0 && Less(item, Items[Parent(index)]))
+            SiftUp(index);
+        else
+            SiftDown(index);
+    }
+
+    bool erase(TItem* item) noexcept {
+        auto index = item->TimerHeapIndex;
+        if (index >= Items.size() || Items[index] != item)
+            return false;
+        RemoveAt(index);
+        return true;
+    }
+
+    void clear() noexcept {
+        for (auto item: Items)
+            item->TimerHeapIndex = TTimerHeapHook::NOT_QUEUED;
+        Items.clear();
+    }
+
+    void shrink_to_fit() {
+        Items.shrink_to_fit();
+    }
+
+protected:
+    std::vector<TItem*> Items;
+
+    static size_t Parent(size_t index) noexcept {
+        return (index - 1) / ARITY;
+    }
+
+    static bool Less(const TItem* left, const TItem* right) noexcept {
+        return left->GetDeadline() < right->GetDeadline();
+    }
+
+    void Place(TItem* item, size_t index) noexcept {
+        Items[index] = item;
+        item->TimerHeapIndex = index;
+    }
+
+    void RemoveAt(size_t index) noexcept {
+        Items[index]->TimerHeapIndex = TTimerHeapHook::NOT_QUEUED;
+        auto last = Items.back();
+        Items.pop_back();
+        if (index == Items.size())
+            return;
+        Place(last, index);
+        update(last);
+    }
+
+    void SiftUp(size_t index) noexcept {
+        auto item = Items[index];
+        while (index > 0) {
+            auto parent = Parent(index);
+            if (!Less(item, Items[parent]))
+                break;
+            Place(Items[parent], index);
+            index = parent;
+        }
+        Place(item, index);
+    }
+
+    void SiftDown(size_t index) noexcept {
+        auto item = Items[index];
+        auto size = Items.size();
+        for (;;) {
+            auto first = index * ARITY + 1;
+            if (first >= size)
+                break;
+            auto last = first + ARITY < size ? first + ARITY : size;
+            auto best = first;
+            for (auto i = first + 1; i < last; ++i)
+                if (Less(Items[i], Items[best]))
+                    best = i;
+            if (!Less(Items[best], item))
+                break;
+            Place(Items[best], index);
+            index = best;
+        }
+        Place(item, index);
+    }
+};
+
+
+} // namespace bsc
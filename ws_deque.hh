@@ -0,0 +1,154 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+Copyright (c) 2018 Vitaliy Manushkin.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+#include "types.hh"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+namespace bsc {
+
+
+// Chase-Lev work stealing deque. The owner thread pushes and pops at the
+// bottom, any thread may steal from the top. TItem must be trivially
+// copyable. Arrays outgrown by push() are kept until the deque is
+// destroyed, a thief may still read them.
+template <typename TItem>
+class TWorkStealingDeque {
+public:
+    explicit TWorkStealingDeque(size_t capacity = 64)
+        : Top(0)
+        , Bottom(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        Arrays.emplace_back(new TArray(size));
+        Array.store(Arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    TWorkStealingDeque(const TWorkStealingDeque&) = delete;
+    void operator=(const TWorkStealingDeque&) = delete;
+
+    // owner only
+    void push(TItem item) {
+        auto bottom = Bottom.load(std::memory_order_relaxed);
+        auto top = Top.load(std::memory_order_acquire);
+        auto array = Array.load(std::memory_order_relaxed);
+        if (bottom - top >= (i64) array->Size)
+            array = Grow(array, top, bottom);
+        array->Put(bottom, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        Bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // owner only
+    bool pop(TItem* item) {
+        auto bottom = Bottom.load(std::memory_order_relaxed) - 1;
+        auto array = Array.load(std::memory_order_relaxed);
+        Bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = Top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            Bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        *item = array->Get(bottom);
+        if (top == bottom) {
+            // the last item, race with thieves
+            bool won = Top.compare_exchange_strong(
+                top, top + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+            Bottom.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool steal(TItem* item) {
+        auto top = Top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto bottom = Bottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return false;
+
+        auto array = Array.load(std::memory_order_acquire);
+        auto result = array->Get(top);
+        if (!Top.compare_exchange_strong(
+                top, top + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+        *item = result;
+        return true;
+    }
+
+    // may be stale if other threads are working with the deque
+    bool empty() const noexcept {
+        auto bottom = Bottom.load(std::memory_order_relaxed);
+        auto top = Top.load(std::memory_order_relaxed);
+        return bottom <= top;
+    }
+
+protected:
+    struct TArray {
+        explicit TArray(size_t size)
+            : Size(size)
+            , Items(new std::atomic<TItem>[size])
+        {}
+
+        TItem Get(i64 index) const noexcept {
+            return Items[index & (Size - 1)].load(std::memory_order_relaxed);
+        }
+
+        void Put(i64 index, TItem item) noexcept {
+            Items[index & (Size - 1)].store(item, std::memory_order_relaxed);
+        }
+
+        const size_t Size; // power of two
+        std::unique_ptr<std::atomic<TItem>[]> Items;
+    };
+
+    // keep the ends on different cache lines
+    std::atomic<i64> Top;
+    char Padding[64 - sizeof(std::atomic<i64>)];
+    std::atomic<i64> Bottom;
+    std::atomic<TArray*> Array;
+    std::vector<std::unique_ptr<TArray>> Arrays;
+
+    TArray* Grow(TArray* array, i64 top, i64 bottom) {
+        Arrays.emplace_back(new TArray(array->Size * 2));
+        auto grown = Arrays.back().get();
+        for (auto i = top; i < bottom; ++i)
+            grown->Put(i, array->Get(i));
+        Array.store(grown, std::memory_order_release);
+        return grown;
+    }
+};
+
+
+} // namespace bsc